@@ -0,0 +1,82 @@
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#include "ambient_occlusion.h"
+#include "objects.h"
+#include "camera.h"
+#include "sampler.h"
+#include "randoms.h"
+
+static bool ambient_ray(const SceneRoot& root, const Camera& camera, float du, float dv, Sampler& sampler, Ray& ray)
+{
+  Ray primary = camera.get_ray<false, false>(du, dv, sampler);
+  HitRecord record;
+  if (!root.hit(primary, t_min, t_max, record))
+    return false;
+
+  float u, v;
+  sampler.next_2d(u, v);
+  ray = Ray(record.position, to_world(cosine_sample_hemisphere(u, v), record.normal), primary.time);
+  return true;
+}
+
+Color trace_ambient_occlusion(const SceneRoot& root, const Camera& camera, float du, float dv, Sampler& sampler, int)
+{
+  Ray ray;
+  if (!ambient_ray(root, camera, du, dv, sampler, ray))
+    return Vec3(1);
+
+  return root.occluded(ray, t_min, ao_distance) ? Vec3(0) : Vec3(1);
+}
+
+OcclusionBenchmark benchmark_occlusion(const SceneRoot& root, const Camera& camera, int width, int height, int rays_per_pixel)
+{
+  Sampler* sampler = create_sampler(SamplerType::Sobol, rays_per_pixel, 0);
+  std::vector<Ray> rays;
+  rays.reserve(size_t(width) * height * rays_per_pixel);
+
+  for (int h = 0; h < height; ++h)
+    for (int w = 0; w < width; ++w)
+      for (int i = 0; i < rays_per_pixel; ++i)
+      {
+        float jitter_u, jitter_v;
+        sampler->start_sample(w, h, i);
+        sampler->next_2d(jitter_u, jitter_v);
+
+        Ray ray;
+        if (ambient_ray(root, camera, (w + jitter_u) / width, (height - h + jitter_v) / height, *sampler, ray))
+          rays.push_back(ray);
+      }
+  delete sampler;
+
+  OcclusionBenchmark result;
+  result.ray_count = (long long)rays.size();
+  if (rays.empty())
+    return result;
+
+  std::vector<char> occluded(rays.size()), hit(rays.size());
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rays.size(); ++i)
+    occluded[i] = root.occluded(rays[i], t_min, ao_distance);
+  auto middle = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    HitRecord record;
+    hit[i] = root.hit(rays[i], t_min, ao_distance, record);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < rays.size(); ++i)
+    if (occluded[i] != hit[i])
+      ++result.mismatch_count;
+
+  double any_hit_seconds = std::chrono::duration<double>(middle - start).count();
+  double closest_hit_seconds = std::chrono::duration<double>(end - middle).count();
+  if (any_hit_seconds > 0)
+    result.any_hit_rays_per_second = double(rays.size()) / any_hit_seconds;
+  if (closest_hit_seconds > 0)
+    result.closest_hit_rays_per_second = double(rays.size()) / closest_hit_seconds;
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "vector.h"
+#include "renderer.h"
+
+struct SceneRoot;
+struct Sampler;
+class Camera;
+
+// occluders further than this from the shaded point are ignored
+const float ao_distance = 1.0f;
+
+// RenderKernel shading the first hit by one cosine weighted visibility ray, max_depth is unused
+Color trace_ambient_occlusion(const SceneRoot& root, const Camera& camera, float du, float dv, Sampler& sampler, int max_depth);
+
+struct OcclusionBenchmark
+{
+  long long ray_count = 0;
+  // rays where occluded and hit disagree, anything but 0 is a bug
+  long long mismatch_count = 0;
+  double any_hit_rays_per_second = 0;
+  double closest_hit_rays_per_second = 0;
+};
+
+// Traces the ambient occlusion rays of a width x height image once with occluded and once with hit.
+OcclusionBenchmark benchmark_occlusion(const SceneRoot& root, const Camera& camera, int width, int height, int rays_per_pixel);
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include <math.h>
+#include <stdlib.h>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "batch_runner.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "image.h"
+#include "trace.h"
+
+bool load_batch_jobs(const char* path, std::vector<BatchJob>& jobs, std::vector<int>& bad_lines)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line))
+  {
+    ++line_number;
+    std::istringstream fields(line);
+    BatchJob job;
+    if (!(fields >> job.scene) || job.scene[0] == '#')
+      continue;
+
+    CameraOrbit& camera = job.camera;
+    if (fields >> camera.target.x >> camera.target.y >> camera.target.z >> camera.theta >> camera.phi >> camera.distance
+      >> job.width >> job.height >> job.sample_count >> job.output && job.width > 0 && job.height > 0 && job.sample_count > 0)
+      jobs.push_back(job);
+    else
+      bad_lines.push_back(line_number);
+  }
+  return true;
+}
+
+// blocking queue of at most capacity items, close wakes every waiter
+template <typename T>
+class BoundedQueue
+{
+private:
+  std::deque<T> items;
+  size_t capacity;
+  bool closed = false;
+  std::mutex security;
+  std::condition_variable not_full, not_empty;
+
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity < 1 ? 1 : capacity) {}
+
+  // false once the queue is closed
+  bool push(T item)
+  {
+    std::unique_lock<std::mutex> lock(security);
+    not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+    if (closed)
+      return false;
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // false once the queue is closed and empty
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(security);
+    not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(security);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+};
+
+struct LoadedJob
+{
+  const BatchJob* job = nullptr;
+  std::shared_ptr<Scene> scene;
+};
+
+struct FinishedImage
+{
+  const BatchJob* job = nullptr;
+  std::vector<Pixel> pixels;
+};
+
+struct TracingJob
+{
+  const BatchJob* job;
+  std::shared_ptr<RenderJob> render;
+};
+
+static inline double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the seed after the colon makes a random scene reproducible, nullptr for unknown names and malformed seeds
+static Scene* load_scene(const std::string& name)
+{
+  size_t colon = name.find(':');
+  unsigned seed = 1;
+  if (colon != std::string::npos)
+  {
+    const char* digits = name.c_str() + colon + 1;
+    char* end;
+    seed = unsigned(strtoul(digits, &end, 10));
+    if (end == digits || *end != '\0' || *digits == '-')
+      return nullptr;
+  }
+  if (name.compare(0, colon, "random") == 0)
+  {
+    srand(seed);
+    return create_random_scene();
+  }
+  return nullptr;
+}
+
+static void load_stage(const std::vector<BatchJob>& jobs, BoundedQueue<LoadedJob>& loaded, const CancellationToken& token,
+  BatchStageStats& stats, int& failed_count)
+{
+  std::shared_ptr<Scene> scene;
+  std::string scene_name;
+  for (auto iter = jobs.begin(); iter != jobs.end() && !token.is_cancelled(); ++iter)
+  {
+    if (!scene || iter->scene != scene_name)
+    {
+      // let go of the previous scene before building the next, the pipeline holds the rest
+      scene.reset();
+      auto start = std::chrono::steady_clock::now();
+      {
+        TraceScope trace("load scene", "batch");
+        scene.reset(load_scene(iter->scene));
+        if (scene)
+          scene->set_frame(0);
+      }
+      stats.busy_seconds += seconds_since(start);
+
+      if (!scene)
+      {
+        ++failed_count;
+        continue;
+      }
+      scene_name = iter->scene;
+      ++stats.item_count;
+    }
+
+    LoadedJob job;
+    job.job = &*iter;
+    job.scene = scene;
+    if (!loaded.push(job))
+      break;
+  }
+  loaded.close();
+}
+
+static void write_stage(BoundedQueue<FinishedImage>& finished, BatchStats& stats)
+{
+  FinishedImage image;
+  while (finished.pop(image))
+  {
+    auto start = std::chrono::steady_clock::now();
+    bool written;
+    {
+      TraceScope trace("write image", "batch");
+      written = write_ppm(image.job->output.c_str(), image.pixels.data(), image.job->width, image.job->height);
+    }
+    stats.write.busy_seconds += seconds_since(start);
+
+    if (written)
+    {
+      ++stats.write.item_count;
+      stats.byte_count += (long long)(image.pixels.size()) * 3;
+    }
+    else
+      ++stats.failed_count;
+  }
+}
+
+static TracingJob start_job(ThreadPool& pool, const LoadedJob& loaded, const BatchSettings& settings, const CancellationToken& token)
+{
+  const BatchJob& job = *loaded.job;
+  RenderJobSettings render_settings;
+  render_settings.width = job.width;
+  render_settings.height = job.height;
+  render_settings.sample_count = job.sample_count;
+  render_settings.max_depth = settings.max_depth;
+  render_settings.kernel = settings.kernel;
+
+  Camera camera = job.camera.make_camera(job.height / float(job.width));
+  TracingJob tracing = { &job, start_render(pool, loaded.scene, camera, render_settings, token) };
+  return tracing;
+}
+
+BatchStats run_batch(ThreadPool& pool, const std::vector<BatchJob>& jobs, const BatchSettings& settings, CancellationToken token)
+{
+  auto batch_start = std::chrono::steady_clock::now();
+  BatchStats stats;
+  int load_failed_count = 0;
+
+  BoundedQueue<LoadedJob> loaded(size_t(settings.load_ahead));
+  BoundedQueue<FinishedImage> finished(size_t(settings.write_queue));
+  std::thread loader(load_stage, std::cref(jobs), std::ref(loaded), std::cref(token), std::ref(stats.load), std::ref(load_failed_count));
+  std::thread writer(write_stage, std::ref(finished), std::ref(stats));
+
+  // Two jobs are kept on the pool, the second one's tiles queue behind the first one's and take
+  // over the workers as the first runs out of tiles. The stage counts as idle while it waits
+  // for a scene with nothing tracing, or for the writer to make room.
+  std::deque<TracingJob> tracing;
+  bool loader_done = false;
+  double idle_seconds = 0;
+  while (!token.is_cancelled())
+  {
+    while (!loader_done && tracing.size() < 2)
+    {
+      auto wait_start = std::chrono::steady_clock::now();
+      LoadedJob next;
+      loader_done = !loaded.pop(next);
+      if (tracing.empty())
+        idle_seconds += seconds_since(wait_start);
+      if (!loader_done)
+        tracing.push_back(start_job(pool, next, settings, token));
+    }
+    if (tracing.empty())
+      break;
+
+    TracingJob done = tracing.front();
+    tracing.pop_front();
+    if (done.render->wait() != RenderStatus::Finished)
+      break;
+
+    FinishedImage image;
+    image.job = done.job;
+    image.pixels = done.render->image();
+    ++stats.trace.item_count;
+    stats.sample_count += (long long)(done.job->width) * done.job->height * done.job->sample_count;
+    // the scene goes with the job, unless a later job still shares it
+    done.render.reset();
+
+    auto wait_start = std::chrono::steady_clock::now();
+    finished.push(std::move(image));
+    idle_seconds += seconds_since(wait_start);
+  }
+  stats.trace.busy_seconds = seconds_since(batch_start) - idle_seconds;
+
+  // on cancellation the jobs still tracing share the token, their remaining tiles are skipped
+  loaded.close();
+  for (auto iter = tracing.begin(); iter != tracing.end(); ++iter)
+    iter->render->wait();
+  finished.close();
+  loader.join();
+  writer.join();
+
+  stats.failed_count += load_failed_count;
+  stats.seconds = seconds_since(batch_start);
+  return stats;
+}
\ No newline at end of file
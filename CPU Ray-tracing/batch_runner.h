@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "render_job.h"
+
+class ThreadPool;
+
+// one render of a batch
+struct BatchJob
+{
+  // scene name with an optional decimal seed, "random" or "random:7"
+  std::string scene;
+  CameraOrbit camera;
+  int width = 0;
+  int height = 0;
+  int sample_count = 16;
+  // written as binary PPM
+  std::string output;
+};
+
+// One job per line: scene target_x target_y target_z theta phi distance width height spp output
+// Blank lines and lines starting with # are skipped, the line numbers of malformed lines are
+// added to bad_lines. False if the file cannot be read.
+bool load_batch_jobs(const char* path, std::vector<BatchJob>& jobs, std::vector<int>& bad_lines);
+
+struct BatchSettings
+{
+  int max_depth = 50;
+  // replaces the kernel specialized for each scene, e.g. trace_ambient_occlusion
+  RenderKernel kernel = nullptr;
+
+  // Scenes loaded ahead of the jobs being traced and finished images waiting for the writer.
+  // With two jobs tracing at once and one of each being loaded and written, at most
+  // load_ahead + 3 scenes and write_queue + 3 images are alive.
+  int load_ahead = 1;
+  int write_queue = 2;
+};
+
+struct BatchStageStats
+{
+  // scenes loaded, jobs traced or images written
+  long long item_count = 0;
+  // time the stage spent working, it waited on the other stages for the rest of the run
+  double busy_seconds = 0;
+};
+
+struct BatchStats
+{
+  BatchStageStats load, trace, write;
+  long long sample_count = 0;
+  long long byte_count = 0;
+  // unknown scenes, malformed seeds and failed writes, their jobs are skipped
+  int failed_count = 0;
+  double seconds = 0;
+};
+
+// Runs the jobs as a three stage pipeline:
+// a loader thread creates the scene of the next job and builds its BVH while the current one traces,
+// the calling thread keeps two jobs in flight on the pool so the tail of one overlaps the next,
+// and a writer thread encodes and writes finished images.
+// Consecutive jobs naming the same scene share one load.
+BatchStats run_batch(ThreadPool& pool, const std::vector<BatchJob>& jobs, const BatchSettings& settings,
+  CancellationToken token = CancellationToken());
\ No newline at end of file
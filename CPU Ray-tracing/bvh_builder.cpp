@@ -0,0 +1,277 @@
+#include <math.h>
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "bvh_builder.h"
+#include "objects.h"
+
+// inputs smaller than this per thread are not worth starting threads for
+static const size_t min_objects_per_thread = 1024;
+// top-level subtrees handed to workers, per thread, so uneven subtrees still balance
+static const size_t tasks_per_thread = 8;
+
+struct LBVHBuild
+{
+  std::vector<Object*> objects;
+  std::vector<AABB> boxes;
+  std::vector<uint32_t> codes;
+};
+
+struct BuildTask
+{
+  Object** slot;
+  size_t from, to;
+};
+
+// runs body(begin, end, chunk) on chunk_count contiguous parts of [0, count), one thread each
+template <typename Body>
+static void parallel_chunks(size_t count, int chunk_count, const Body& body)
+{
+  std::vector<std::thread> threads;
+  for (int chunk = 1; chunk < chunk_count; ++chunk)
+    threads.push_back(std::thread([&body, count, chunk, chunk_count]()
+    {
+      body(count * chunk / chunk_count, count * (chunk + 1) / chunk_count, chunk);
+    }));
+  body(0, count / chunk_count, 0);
+
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+    iter->join();
+}
+
+// spreads the low 10 bits of v to every third bit
+static inline uint32_t expand_bits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xff0000ffu;
+  v = (v * 0x00000101u) & 0x0f00f00fu;
+  v = (v * 0x00000011u) & 0xc30c30c3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// Stable LSD radix sort on the low 32 bits, 8 bits per pass. Every chunk histograms its part,
+// offsets are laid out digit major then chunk, so each chunk scatters into its own slots.
+static void radix_sort(std::vector<uint64_t>& keys, int chunk_count)
+{
+  const int buckets = 256;
+  std::vector<uint64_t> scratch(keys.size());
+  std::vector<size_t> offsets(size_t(chunk_count) * buckets);
+
+  for (int shift = 0; shift < 32; shift += 8)
+  {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    parallel_chunks(keys.size(), chunk_count, [&](size_t begin, size_t end, int chunk)
+    {
+      size_t* histogram = &offsets[size_t(chunk) * buckets];
+      for (size_t i = begin; i < end; ++i)
+        ++histogram[(keys[i] >> shift) & 0xff];
+    });
+
+    size_t offset = 0;
+    for (int digit = 0; digit < buckets; ++digit)
+      for (int chunk = 0; chunk < chunk_count; ++chunk)
+      {
+        size_t& slot = offsets[size_t(chunk) * buckets + digit];
+        size_t count = slot;
+        slot = offset;
+        offset += count;
+      }
+
+    parallel_chunks(keys.size(), chunk_count, [&](size_t begin, size_t end, int chunk)
+    {
+      size_t* next = &offsets[size_t(chunk) * buckets];
+      for (size_t i = begin; i < end; ++i)
+        scratch[next[(keys[i] >> shift) & 0xff]++] = keys[i];
+    });
+    keys.swap(scratch);
+  }
+}
+
+// first index whose code has the highest bit differing within the range set,
+// ranges of identical codes are halved
+static size_t find_split(const std::vector<uint32_t>& codes, size_t from, size_t to)
+{
+  uint32_t first = codes[from];
+  uint32_t last = codes[to - 1];
+  if (first == last)
+    return (from + to) / 2;
+
+  uint32_t diff = first ^ last;
+  diff |= diff >> 1;
+  diff |= diff >> 2;
+  diff |= diff >> 4;
+  diff |= diff >> 8;
+  diff |= diff >> 16;
+  uint32_t bit = diff ^ (diff >> 1);
+
+  // codes agree above bit, the ones having it set are sorted last
+  return std::partition_point(codes.begin() + from, codes.begin() + to,
+    [bit](uint32_t code) { return (code & bit) == 0; }) - codes.begin();
+}
+
+static BVHnode* build_node(const LBVHBuild& build, size_t from, size_t to, size_t& node_count)
+{
+  BVHnode* node = new BVHnode();
+  ++node_count;
+
+  // leaves keep the layout of the sorting build, one or two objects
+  if (to - from <= 2)
+  {
+    node->left = build.objects[from];
+    node->right = build.objects[to - 1];
+    node->child_is_obj = true;
+    node->aabb = build.boxes[from] + build.boxes[to - 1];
+  }
+  else
+  {
+    size_t split = find_split(build.codes, from, to);
+    BVHnode* left = build_node(build, from, split, node_count);
+    BVHnode* right = build_node(build, split, to, node_count);
+    node->left = left;
+    node->right = right;
+    node->child_is_obj = false;
+    node->aabb = left->aabb + right->aabb;
+  }
+  node->build_area = node->aabb.surface_area();
+  return node;
+}
+
+// splits until ranges are small enough to be one task, top_nodes ends up parents before children
+static void split_top(const LBVHBuild& build, size_t from, size_t to, size_t task_objects, Object** slot,
+  std::vector<BuildTask>& tasks, std::vector<BVHnode*>& top_nodes)
+{
+  if (to - from <= task_objects || to - from <= 2)
+  {
+    BuildTask task = { slot, from, to };
+    tasks.push_back(task);
+    return;
+  }
+
+  BVHnode* node = new BVHnode();
+  node->child_is_obj = false;
+  *slot = node;
+  top_nodes.push_back(node);
+
+  size_t split = find_split(build.codes, from, to);
+  split_top(build, from, split, task_objects, &node->left, tasks, top_nodes);
+  split_top(build, split, to, task_objects, &node->right, tasks, top_nodes);
+}
+
+BVHnode* build_lbvh(std::vector<Object*>& objects, float t0, float t1, int thread_count, BVHBuildStats* stats)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  if (thread_count <= 0)
+    thread_count = int(std::thread::hardware_concurrency());
+  if (thread_count <= 0)
+    thread_count = 1;
+
+  size_t count = objects.size();
+  if (count == 0)
+    return nullptr;
+
+  int chunk_count = thread_count;
+  if (count < size_t(chunk_count) * min_objects_per_thread)
+    chunk_count = 1;
+
+  // bounds once per object, and the centroid bounds they span
+  std::vector<AABB> boxes(count);
+  std::vector<AABB> chunk_centroids(chunk_count, AABB(Vec3(INFINITY), Vec3(-INFINITY)));
+  parallel_chunks(count, chunk_count, [&](size_t begin, size_t end, int chunk)
+  {
+    AABB& centroids = chunk_centroids[chunk];
+    for (size_t i = begin; i < end; ++i)
+    {
+      objects[i]->bounding_box(t0, t1, boxes[i]);
+      Vec3 centroid = 0.5f * (boxes[i].pos_min + boxes[i].pos_max);
+      centroids = centroids + AABB(centroid, centroid);
+    }
+  });
+
+  AABB centroids = chunk_centroids[0];
+  for (int chunk = 1; chunk < chunk_count; ++chunk)
+    centroids = centroids + chunk_centroids[chunk];
+
+  Vec3 extent = centroids.pos_max - centroids.pos_min;
+  Vec3 scale(
+    extent.x > 0 ? 1023.0f / extent.x : 0,
+    extent.y > 0 ? 1023.0f / extent.y : 0,
+    extent.z > 0 ? 1023.0f / extent.z : 0);
+
+  // Morton code in the low bits, so the sort carries the object index along
+  std::vector<uint64_t> keys(count);
+  parallel_chunks(count, chunk_count, [&](size_t begin, size_t end, int)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      Vec3 cell = (0.5f * (boxes[i].pos_min + boxes[i].pos_max) - centroids.pos_min) * scale;
+      uint32_t code = (expand_bits(uint32_t(cell.x)) << 2) | (expand_bits(uint32_t(cell.y)) << 1) | expand_bits(uint32_t(cell.z));
+      keys[i] = (uint64_t(i) << 32) | code;
+    }
+  });
+  radix_sort(keys, chunk_count);
+
+  LBVHBuild build;
+  build.objects.resize(count);
+  build.boxes.resize(count);
+  build.codes.resize(count);
+  parallel_chunks(count, chunk_count, [&](size_t begin, size_t end, int)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      size_t index = size_t(keys[i] >> 32);
+      build.objects[i] = objects[index];
+      build.boxes[i] = boxes[index];
+      build.codes[i] = uint32_t(keys[i]);
+    }
+  });
+  std::vector<uint64_t>().swap(keys);
+  std::vector<AABB>().swap(boxes);
+
+  size_t task_objects = count / (size_t(chunk_count) * tasks_per_thread);
+  if (chunk_count == 1 || task_objects < min_objects_per_thread)
+    task_objects = chunk_count == 1 ? count : min_objects_per_thread;
+
+  Object* root = nullptr;
+  std::vector<BuildTask> tasks;
+  std::vector<BVHnode*> top_nodes;
+  split_top(build, 0, count, task_objects, &root, tasks, top_nodes);
+
+  // largest subtrees first, the small ones fill in at the end
+  std::sort(tasks.begin(), tasks.end(), [](const BuildTask& lhs, const BuildTask& rhs)
+  {
+    return lhs.to - lhs.from > rhs.to - rhs.from;
+  });
+
+  std::atomic<size_t> next_task(0);
+  std::atomic<size_t> node_count(top_nodes.size());
+  int worker_count = int(tasks.size()) < chunk_count ? int(tasks.size()) : chunk_count;
+  parallel_chunks(size_t(worker_count), worker_count, [&](size_t, size_t, int)
+  {
+    size_t local_count = 0;
+    for (size_t index = next_task++; index < tasks.size(); index = next_task++)
+      *tasks[index].slot = build_node(build, tasks[index].from, tasks[index].to, local_count);
+    node_count += local_count;
+  });
+
+  for (auto iter = top_nodes.rbegin(); iter != top_nodes.rend(); ++iter)
+  {
+    BVHnode* node = *iter;
+    node->aabb = static_cast<BVHnode*>(node->left)->aabb + static_cast<BVHnode*>(node->right)->aabb;
+    node->build_area = node->aabb.surface_area();
+  }
+
+  objects.swap(build.objects);
+
+  if (stats)
+  {
+    stats->object_count = count;
+    stats->node_count = node_count;
+    stats->thread_count = chunk_count;
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  return static_cast<BVHnode*>(root);
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+struct Object;
+struct BVHnode;
+
+struct BVHBuildStats
+{
+  size_t object_count = 0;
+  size_t node_count = 0;
+  int thread_count = 0;
+  double seconds = 0;
+};
+
+// Linear BVH: objects are sorted along a 30 bit Morton curve of their centroids with a parallel
+// radix sort, then split top-down at the highest differing code bit. The top of the tree is split
+// on the calling thread and the subtrees below are built by thread_count workers.
+// objects are reordered, thread_count 0 uses every hardware thread, stats may be null.
+BVHnode* build_lbvh(std::vector<Object*>& objects, float t0, float t1, int thread_count, BVHBuildStats* stats);
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <math.h>
+
+#include "camera.h"
+
+Camera::Camera(const Vec3& position, float theta, float phi, float focus_dist, float time_from, float time_to, float resolution_ratio) : focus_dist(focus_dist), time_from(time_from), time_to(time_to), position(position)
+{
+  look = look_direction(theta, phi);
+
+  float tan_half_fov = tanf(pi / 12) * focus_dist;
+
+  Vec3 quad_center = position + look * focus_dist;
+  Vec3 right_hand = Vec3(look.z, 0, -look.x);
+
+  right = Vec3::cross(Vec3(0,1,0), look);
+  up = Vec3::cross(look, right);
+
+  if (resolution_ratio < 1)
+  {
+    horizontal = Vec3::cross(Vec3(0, 1, 0), look) * tan_half_fov * 2 / resolution_ratio;
+    vertical = Vec3::cross(look, right_hand) * tan_half_fov * 2;
+  }
+  else
+  {
+    horizontal = Vec3::cross(Vec3(0, 1, 0), look) * tan_half_fov * 2;
+    vertical = Vec3::cross(look, right_hand) * tan_half_fov * 2 * resolution_ratio;
+  }
+  bottom_left = quad_center - horizontal * .5f - vertical * .5f;
+}
+
+Ray Camera::get_center_ray(float du, float dv) const
+{
+  return Ray(position, bottom_left + du * horizontal + dv * vertical - position, .5f * (time_from + time_to));
+}
+
+bool Camera::project(const Vec3& point, float& du, float& dv) const
+{
+  Vec3 normal = Vec3::cross(horizontal, vertical);
+  Vec3 direction = point - position;
+  float denominator = Vec3::dot(direction, normal);
+  float t = Vec3::dot(bottom_left - position, normal);
+  if (denominator * t <= 0)
+    return false;
+
+  Vec3 on_plane = direction * (t / denominator) + position - bottom_left;
+  du = Vec3::dot(on_plane, horizontal) / horizontal.lengthSqr();
+  dv = Vec3::dot(on_plane, vertical) / vertical.lengthSqr();
+  return true;
+}
+
+Vec3 Camera::look_direction(float theta, float phi)
+{
+  return { cosf(phi) * cosf(theta), tanf(phi), cosf(phi) * sinf(theta) };
+}
+
+Camera CameraOrbit::make_camera(float resolution_ratio) const
+{
+  Camera camera(position(), theta, phi, distance, 0, 1, resolution_ratio);
+  camera.lens_radius = 0.08f;
+  return camera;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vector.h"
+#include "ray.h"
+#include "randoms.h"
+#include "sampler.h"
+
+class Camera
+{
+private:
+  Vec3 bottom_left, horizontal, vertical;
+  Vec3 up, right, look;
+  float focus_dist;
+  float time_from, time_to;
+
+public:
+  Vec3 position;
+  float lens_radius = 0;
+
+  Camera(const Vec3& position, float theta, float phi, float focus_dist, float time_from, float time_to, float resolution_ratio);
+
+  // Lens and shutter dimensions are only drawn when their feature is enabled,
+  // so a pinhole camera over a static scene skips both.
+  template <bool DepthOfField, bool MotionBlur>
+  inline Ray get_ray(float du, float dv, Sampler& sampler) const
+  {
+    Vec3 offset(0);
+    if (DepthOfField)
+    {
+      float lens_u, lens_v;
+      sampler.next_2d(lens_u, lens_v);
+      Vec3 rd = lens_radius * concentric_sample_disk(lens_u, lens_v);
+      offset = right * rd.x + up * rd.y;
+    }
+    float time = MotionBlur ? time_from + sampler.next_1d() * (time_to - time_from) : time_from;
+    return Ray(position + offset, bottom_left + du * horizontal + dv * vertical - position - offset, time);
+  }
+
+  inline bool has_shutter() const { return time_to > time_from; }
+  // ray through the lens center at mid-shutter, used for first-hit buffers
+  Ray get_center_ray(float du, float dv) const;
+  // inverse of the screen mapping, false if point is behind the camera
+  bool project(const Vec3& point, float& du, float& dv) const;
+
+  static Vec3 look_direction(float theta, float phi);
+};
+
+// orbits a camera around a fixed target, for interactive sessions
+struct CameraOrbit
+{
+  Vec3 target;
+  float theta, phi;
+  float distance;
+
+  inline Vec3 position() const { return target - Camera::look_direction(theta, phi) * distance; }
+  // the camera the window and batch jobs render from, focused on the target with a shutter over [0, 1]
+  Camera make_camera(float resolution_ratio) const;
+};
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <fstream>
+
+#include "checkpoint.h"
+#include "film.h"
+
+static const uint32_t checkpoint_magic = 0x4b435452; // "RTCK"
+static const uint32_t checkpoint_version = 1;
+
+template <typename T>
+static void write_value(std::ofstream& file, const T& value)
+{
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool read_value(std::ifstream& file, T& value)
+{
+  return bool(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+void Checkpoint::capture(const Film& film)
+{
+  width = film.width;
+  height = film.height;
+  color_sum = film.color_sum;
+  sample_count = film.sample_count;
+}
+
+bool Checkpoint::restore(Film& film) const
+{
+  if (film.width != width || film.height != height)
+    return false;
+
+  film.color_sum = color_sum;
+  film.sample_count = sample_count;
+  return true;
+}
+
+bool save_checkpoint(const char* path, const Checkpoint& checkpoint)
+{
+  // write next to the target and swap it in, a crash mid-write keeps the last good checkpoint
+  std::string temp_path = std::string(path) + ".tmp";
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file)
+      return false;
+
+    write_value(file, checkpoint_magic);
+    write_value(file, checkpoint_version);
+    write_value(file, checkpoint.scene_hash);
+    write_value(file, uint32_t(checkpoint.sampler_type));
+    write_value(file, checkpoint.sampler_seed);
+    write_value(file, checkpoint.camera_orbit);
+    write_value(file, checkpoint.width);
+    write_value(file, checkpoint.height);
+
+    size_t pixel_count = size_t(checkpoint.width) * checkpoint.height;
+    file.write(reinterpret_cast<const char*>(checkpoint.color_sum.data()), pixel_count * sizeof(Color));
+    file.write(reinterpret_cast<const char*>(checkpoint.sample_count.data()), pixel_count * sizeof(int));
+    if (!file)
+      return false;
+  }
+
+  remove(path);
+  return rename(temp_path.c_str(), path) == 0;
+}
+
+bool load_checkpoint(const char* path, Checkpoint& checkpoint)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  uint32_t magic, version, sampler_type;
+  if (!read_value(file, magic) || magic != checkpoint_magic)
+    return false;
+  if (!read_value(file, version) || version != checkpoint_version)
+    return false;
+
+  if (!read_value(file, checkpoint.scene_hash) ||
+      !read_value(file, sampler_type) ||
+      !read_value(file, checkpoint.sampler_seed) ||
+      !read_value(file, checkpoint.camera_orbit) ||
+      !read_value(file, checkpoint.width) ||
+      !read_value(file, checkpoint.height))
+    return false;
+  checkpoint.sampler_type = SamplerType(sampler_type);
+
+  if (checkpoint.width <= 0 || checkpoint.height <= 0)
+    return false;
+
+  size_t pixel_count = size_t(checkpoint.width) * checkpoint.height;
+  checkpoint.color_sum.resize(pixel_count);
+  checkpoint.sample_count.resize(pixel_count);
+  file.read(reinterpret_cast<char*>(checkpoint.color_sum.data()), pixel_count * sizeof(Color));
+  file.read(reinterpret_cast<char*>(checkpoint.sample_count.data()), pixel_count * sizeof(int));
+  return bool(file);
+}
+
+CheckpointWriter::CheckpointWriter()
+{
+  thread = std::thread(&CheckpointWriter::write_loop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  security.lock();
+  quit = true;
+  security.unlock();
+  wake.notify_one();
+
+  if (thread.joinable())
+    thread.join();
+}
+
+void CheckpointWriter::request(const std::string& path, Checkpoint& checkpoint)
+{
+  security.lock();
+  auto iter = pending.begin();
+  while (iter != pending.end() && iter->path != path)
+    ++iter;
+  if (iter == pending.end())
+  {
+    pending.push_back(Request());
+    iter = pending.end() - 1;
+    iter->path = path;
+  }
+  std::swap(iter->checkpoint, checkpoint);
+  security.unlock();
+  wake.notify_one();
+}
+
+void CheckpointWriter::write_loop()
+{
+  std::unique_lock<std::mutex> lock(security);
+  for (;;)
+  {
+    wake.wait(lock, [this]() { return !pending.empty() || quit; });
+    if (pending.empty())
+      return;
+
+    std::swap(pending.front(), writing);
+    pending.erase(pending.begin());
+
+    lock.unlock();
+    save_checkpoint(writing.path.c_str(), writing.checkpoint);
+    lock.lock();
+  }
+}
\ No newline at end of file
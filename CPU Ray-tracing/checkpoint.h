@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "vector.h"
+#include "camera.h"
+#include "sampler.h"
+
+struct Film;
+
+// Accumulation state of a progressive render.
+// Samplers derive every value from (seed, pixel, sample index), so the per-pixel
+// sample counts together with the sampler type and seed are the complete RNG state.
+struct Checkpoint
+{
+  uint32_t scene_hash = 0;
+  SamplerType sampler_type = SamplerType::Random;
+  uint32_t sampler_seed = 0;
+  CameraOrbit camera_orbit;
+
+  int width = 0;
+  int height = 0;
+  std::vector<Color> color_sum;
+  std::vector<int> sample_count;
+
+  void capture(const Film& film);
+  // false if the checkpoint was taken for a different image size
+  bool restore(Film& film) const;
+};
+
+bool save_checkpoint(const char* path, const Checkpoint& checkpoint);
+bool load_checkpoint(const char* path, Checkpoint& checkpoint);
+
+// Saves checkpoints on a background thread, the caller only pays for Checkpoint::capture.
+// A newer request replaces one for the same path that has not started writing yet.
+class CheckpointWriter
+{
+private:
+  struct Request
+  {
+    std::string path;
+    Checkpoint checkpoint;
+  };
+
+  std::thread thread;
+  std::mutex security;
+  std::condition_variable wake;
+  std::vector<Request> pending;
+  Request writing;
+  bool quit = false;
+
+  void write_loop();
+
+public:
+  CheckpointWriter();
+  // writes what is still pending before returning
+  ~CheckpointWriter();
+
+  // takes over the content of checkpoint and leaves it holding buffers to reuse for the next capture
+  void request(const std::string& path, Checkpoint& checkpoint);
+};
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include <math.h>
+
+#include "film.h"
+#include "camera.h"
+
+// relative distance two first hits may differ by and still count as the same surface
+static const float reprojection_tolerance = 0.01f;
+static const float sky_distance = 1e6f;
+
+Film::Film(int width, int height) : width(width), height(height),
+  color_sum(width * height, Vec3(0)), sample_count(width * height, 0),
+  depth(width * height, INFINITY), position(width * height, Vec3(0))
+{
+}
+
+Color Film::resolve(int index) const
+{
+  if (sample_count[index] == 0)
+    return Vec3(0);
+  return color_sum[index] / float(sample_count[index]);
+}
+
+int Film::reproject(const Film& previous, const Camera& previous_camera, int max_history)
+{
+  int reused = 0;
+
+  for (int h = 0; h < height; ++h)
+  {
+    for (int w = 0; w < width; ++w)
+    {
+      int index = h * width + w;
+      bool is_sky = isinf(depth[index]);
+
+      Vec3 point = is_sky ? previous_camera.position + position[index] * sky_distance : position[index];
+
+      float du, dv;
+      if (!previous_camera.project(point, du, dv))
+        continue;
+
+      int previous_w = int(floorf(du * previous.width));
+      int previous_h = previous.height - int(floorf(dv * previous.height));
+      if (previous_w < 0 || previous_w >= previous.width || previous_h < 0 || previous_h >= previous.height)
+        continue;
+
+      int previous_index = previous_h * previous.width + previous_w;
+      if (previous.sample_count[previous_index] == 0)
+        continue;
+
+      if (is_sky != bool(isinf(previous.depth[previous_index])))
+        continue;
+
+      if (!is_sky && (previous.position[previous_index] - point).length() > reprojection_tolerance * depth[index])
+        continue;
+
+      int count = previous.sample_count[previous_index];
+      Color color = previous.color_sum[previous_index];
+      if (count > max_history)
+      {
+        color = color * (float(max_history) / count);
+        count = max_history;
+      }
+      color_sum[index] = color;
+      sample_count[index] = count;
+      ++reused;
+    }
+  }
+
+  return reused;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vector.h"
+
+#include <vector>
+
+class Camera;
+
+// Per-pixel accumulation plus first-hit buffers, rows are top to bottom.
+// Pixel (w, h) is sampled at du = (w + u) / width, dv = (height - h + v) / height.
+struct Film
+{
+  int width = 0;
+  int height = 0;
+  std::vector<Color> color_sum;
+  std::vector<int> sample_count;
+
+  // distance and position of the primary hit through the pixel center,
+  // depth is infinite and position holds the ray direction on a miss
+  std::vector<float> depth;
+  std::vector<Vec3> position;
+
+  inline Film() {}
+  Film(int width, int height);
+
+  inline void add_sample(int index, const Color& color) { color_sum[index] += color; ++sample_count[index]; }
+  Color resolve(int index) const;
+
+  // Gathers accumulation from previous for every pixel of this film whose first hit
+  // reprojects onto the same surface in previous_camera's view. Disoccluded pixels start over.
+  // History is clamped to max_history samples so view dependent shading fades out.
+  // Returns the number of pixels that kept their history.
+  int reproject(const Film& previous, const Camera& previous_camera, int max_history);
+};
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include <math.h>
+#include <fstream>
+#include <vector>
+
+#include "image.h"
+#include "trace.h"
+
+Pixel to_pixel(const Color& color)
+{
+  Pixel pixel;
+  pixel.r = (unsigned char)(255.99f * sqrtf(color.r));
+  pixel.g = (unsigned char)(255.99f * sqrtf(color.g));
+  pixel.b = (unsigned char)(255.99f * sqrtf(color.b));
+  pixel.a = 255;
+  return pixel;
+}
+
+bool write_ppm(const char* path, const Pixel* pixels, int width, int height)
+{
+  TraceScope trace("write ppm", "output");
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  file << "P6\n" << width << " " << height << "\n255\n";
+
+  std::vector<unsigned char> row(width * 3);
+  for (int h = 0; h < height; ++h)
+  {
+    for (int w = 0; w < width; ++w)
+    {
+      const Pixel& pixel = pixels[h * width + w];
+      row[w * 3 + 0] = pixel.r;
+      row[w * 3 + 1] = pixel.g;
+      row[w * 3 + 2] = pixel.b;
+    }
+    file.write(reinterpret_cast<const char*>(row.data()), row.size());
+  }
+
+  return bool(file);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "vector.h"
+
+union Pixel
+{
+  unsigned char data[4];
+  struct
+  {
+    unsigned char b;
+    unsigned char g;
+    unsigned char r;
+    unsigned char a;
+  };
+};
+
+// gamma 2 encoded, color components are expected in [0, 1]
+Pixel to_pixel(const Color& color);
+
+// writes a binary PPM, rows are top to bottom
+bool write_ppm(const char* path, const Pixel* pixels, int width, int height);
\ No newline at end of file
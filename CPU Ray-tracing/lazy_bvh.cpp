@@ -0,0 +1,200 @@
+#include <math.h>
+#include <algorithm>
+
+#include "lazy_bvh.h"
+#include "trace.h"
+
+// midpoint splits of clustered objects are replaced by median splits, which bounds the depth
+static const int max_stack_depth = 128;
+
+static inline float centroid(const AABB& box, int axis)
+{
+  return box.pos_min.data[axis] + box.pos_max.data[axis];
+}
+
+static inline Vec3 centroid(const AABB& box)
+{
+  return box.pos_min + box.pos_max;
+}
+
+LazyBVH::LazyBVH(const std::vector<Object*>& objects, float t0, float t1, int coarse_depth) : nodes_built(1)
+{
+  TraceScope trace("lazy bvh setup", "scene");
+
+  references.resize(objects.size());
+  for (size_t i = 0; i < objects.size(); ++i)
+  {
+    objects[i]->bounding_box(t0, t1, references[i].box);
+    references[i].object = objects[i];
+  }
+
+  root = new Node();
+  root->end = uint32_t(references.size());
+  if (!references.empty())
+    fit(*root);
+  split_coarse(*root, coarse_depth);
+}
+
+LazyBVH::~LazyBVH()
+{
+  delete root;
+}
+
+void LazyBVH::split_coarse(Node& node, int depth)
+{
+  if (depth <= 0 || is_leaf(node))
+    return;
+
+  Node* children = split(node);
+  node.children.store(children, std::memory_order_release);
+  split_coarse(children[0], depth - 1);
+  split_coarse(children[1], depth - 1);
+}
+
+LazyBVH::Node* LazyBVH::children_of(Node& node) const
+{
+  Node* children = node.children.load(std::memory_order_acquire);
+  if (children)
+    return children;
+
+  // nodes share a few locks, a node is split by whoever takes its lock first
+  std::lock_guard<std::mutex> lock(split_security[(reinterpret_cast<uintptr_t>(&node) / sizeof(Node)) % lock_count]);
+  children = node.children.load(std::memory_order_acquire);
+  if (!children)
+  {
+    children = split(node);
+    node.children.store(children, std::memory_order_release);
+  }
+  return children;
+}
+
+LazyBVH::Node* LazyBVH::split(Node& node) const
+{
+  TraceScope trace("bvh refine", "scene");
+
+  Reference* first = references.data() + node.begin;
+  Reference* last = references.data() + node.end;
+
+  const AABB& centroids = node.centroid_box;
+  int axis = 0;
+  for (int i = 1; i < 3; ++i)
+    if (centroids.pos_max.data[i] - centroids.pos_min.data[i] > centroids.pos_max.data[axis] - centroids.pos_min.data[axis])
+      axis = i;
+
+  float middle = 0.5f * (centroids.pos_min.data[axis] + centroids.pos_max.data[axis]);
+  Reference* split_at = std::partition(first, last, [axis, middle](const Reference& ref) { return centroid(ref.box, axis) < middle; });
+
+  // lopsided or impossible midpoint splits fall back to the median
+  size_t count = last - first;
+  size_t left_count = split_at - first;
+  if (left_count < count / 4 || left_count > count - count / 4)
+  {
+    split_at = first + count / 2;
+    std::nth_element(first, split_at, last, [axis](const Reference& lhs, const Reference& rhs)
+    {
+      return centroid(lhs.box, axis) < centroid(rhs.box, axis);
+    });
+  }
+
+  Node* children = new Node[2];
+  children[0].begin = node.begin;
+  children[0].end = children[1].begin = node.begin + uint32_t(split_at - first);
+  children[1].end = node.end;
+  fit(children[0]);
+  fit(children[1]);
+
+  node.axis = axis;
+  nodes_built.fetch_add(2, std::memory_order_relaxed);
+  return children;
+}
+
+// bounds and centroid bounds of the node's range in one pass
+void LazyBVH::fit(Node& node) const
+{
+  const Reference* first = references.data() + node.begin;
+  const Reference* last = references.data() + node.end;
+  AABB box = first->box;
+  AABB centroids(centroid(first->box), centroid(first->box));
+  for (const Reference* ref = first + 1; ref != last; ++ref)
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      float low = ref->box.pos_min.data[axis], high = ref->box.pos_max.data[axis], c = low + high;
+      box.pos_min.data[axis] = low < box.pos_min.data[axis] ? low : box.pos_min.data[axis];
+      box.pos_max.data[axis] = high > box.pos_max.data[axis] ? high : box.pos_max.data[axis];
+      centroids.pos_min.data[axis] = c < centroids.pos_min.data[axis] ? c : centroids.pos_min.data[axis];
+      centroids.pos_max.data[axis] = c > centroids.pos_max.data[axis] ? c : centroids.pos_max.data[axis];
+    }
+  node.box = box;
+  node.centroid_box = centroids;
+}
+
+bool LazyBVH::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  Node* stack[max_stack_depth];
+  int size = 0;
+  stack[size++] = root;
+
+  bool hit_any = false;
+  while (size > 0)
+  {
+    Node& node = *stack[--size];
+    if (!node.box.hit(r, t_min, t_max))
+      continue;
+
+    if (is_leaf(node))
+    {
+      for (uint32_t i = node.begin; i < node.end; ++i)
+        if (references[i].object->hit(r, t_min, t_max, record))
+        {
+          hit_any = true;
+          t_max = record.t;
+        }
+      continue;
+    }
+
+    // the child on the side the ray comes from is popped first
+    Node* children = children_of(node);
+    int near_child = r.direction[node.axis] < 0 ? 1 : 0;
+    stack[size++] = &children[1 - near_child];
+    stack[size++] = &children[near_child];
+  }
+  return hit_any;
+}
+
+bool LazyBVH::occluded(const Ray& r, float t_min, float t_max) const
+{
+  Node* stack[max_stack_depth];
+  int size = 0;
+  stack[size++] = root;
+
+  while (size > 0)
+  {
+    Node& node = *stack[--size];
+    if (!node.box.hit(r, t_min, t_max))
+      continue;
+
+    if (is_leaf(node))
+    {
+      for (uint32_t i = node.begin; i < node.end; ++i)
+        if (references[i].object->occluded(r, t_min, t_max))
+          return true;
+      continue;
+    }
+
+    Node* children = children_of(node);
+    stack[size++] = &children[0];
+    stack[size++] = &children[1];
+  }
+  return false;
+}
+
+bool LazyBVH::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  aabb = root->box;
+  return true;
+}
+
+size_t LazyBVH::memory_bytes() const
+{
+  return sizeof(*this) + node_count() * sizeof(Node) + references.capacity() * sizeof(Reference);
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "objects.h"
+
+// BVH built as rays reach it. Up front only the object bounds are gathered and the top
+// coarse_depth levels split, every other node keeps its range of objects until the first ray
+// enters it, then splits it in two at the centroid midpoint of its longest axis.
+// Children are published with one atomic store after they are complete, so traversal never
+// locks; a thread reaching a node that is being split waits for it instead of splitting it again.
+// Regions no ray reaches stay one unsplit node.
+class LazyBVH : public Object
+{
+public:
+  // objects must all have bounds over [t0, t1], they are not owned
+  LazyBVH(const std::vector<Object*>& objects, float t0, float t1, int coarse_depth);
+  ~LazyBVH();
+
+  LazyBVH(const LazyBVH&) = delete;
+  LazyBVH& operator=(const LazyBVH&) = delete;
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+
+  // nodes split so far, grows while rendering
+  inline size_t node_count() const { return nodes_built.load(std::memory_order_relaxed); }
+  size_t memory_bytes() const;
+
+private:
+  struct Reference
+  {
+    AABB box;
+    Object* object;
+  };
+
+  struct Node
+  {
+    AABB box;
+    // bounds of box.pos_min + box.pos_max of the objects, kept for the split
+    AABB centroid_box;
+    uint32_t begin = 0, end = 0;
+    // axis the children were split along, the first child has the lower centroids
+    int axis = 0;
+    // both children in one allocation, null until the node is split
+    std::atomic<Node*> children;
+
+    Node() : children(nullptr) {}
+    ~Node() { delete[] children.load(); }
+  };
+
+  static const uint32_t leaf_size = 4;
+  static const int lock_count = 64;
+
+  // ranges are only reordered while their node is unsplit, and no ray reads them until it is a leaf
+  mutable std::vector<Reference> references;
+  Node* root;
+  mutable std::atomic<size_t> nodes_built;
+  mutable std::mutex split_security[lock_count];
+
+  inline bool is_leaf(const Node& node) const { return node.end - node.begin <= leaf_size; }
+  Node* children_of(Node& node) const;
+  Node* split(Node& node) const;
+  void fit(Node& node) const;
+  void split_coarse(Node& node, int depth);
+};
\ No newline at end of file
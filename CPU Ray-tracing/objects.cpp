@@ -2,9 +2,12 @@
 
 #include "objects.h"
 #include "randoms.h"
+#include "sampler.h"
+#include "texture.h"
 
 #include <vector>
 #include <algorithm>
+#include <xmmintrin.h>
 
 AABB AABB::operator+(const AABB& rhs) const
 {
@@ -19,24 +22,70 @@ AABB AABB::operator+(const AABB& rhs) const
       fmaxf(pos_max.z, rhs.pos_max.z)));
 }
 
-bool AABB::hit(const Ray& r, float t_min, float t_max) const
-{  
-  for (int i = 0; i < 3; ++i)
-  {
-    float invD = 1 / r.direction[i];
-    float t0 = (pos_min[i] - r.origin[i]) * invD;
-    float t1 = (pos_max[i] - r.origin[i]) * invD;
-    if (invD < 0)
-      std::swap(t0, t1);
-    t_min = t0 > t_min ? t0 : t_min;
-    t_max = t1 < t_max ? t1 : t_max;
+float AABB::surface_area() const
+{
+  Vec3 extent = pos_max - pos_min;
+  return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
 
-    if (t_max <= t_min)
-      return false;
-  }
+static inline int first_lane(int mask)
+{
+  return mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : -1;
+}
+
+// Slab test of all three axes at once. The fourth lane carries [t_min, t_max] so the
+// horizontal reductions clip against the ray interval as well.
+// entry_axis and exit_axis are the axes bounding [t_near, t_far], -1 where the ray interval does.
+static inline bool slab_hit(const Vec3& pos_min, const Vec3& pos_max, const Ray& r, float t_min, float t_max,
+  float& t_near, float& t_far, int& entry_axis, int& exit_axis)
+{
+  __m128 origin = _mm_set_ps(0, r.origin.z, r.origin.y, r.origin.x);
+  __m128 inv_direction = _mm_div_ps(_mm_set1_ps(1), _mm_set_ps(1, r.direction.z, r.direction.y, r.direction.x));
+  __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(t_min, pos_min.z, pos_min.y, pos_min.x), origin), inv_direction);
+  __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(t_max, pos_max.z, pos_max.y, pos_max.x), origin), inv_direction);
+  __m128 lane_near = _mm_min_ps(t0, t1);
+  __m128 lane_far = _mm_max_ps(t0, t1);
+
+  __m128 near4 = _mm_max_ps(lane_near, _mm_shuffle_ps(lane_near, lane_near, _MM_SHUFFLE(2, 3, 0, 1)));
+  near4 = _mm_max_ps(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(1, 0, 3, 2)));
+  __m128 far4 = _mm_min_ps(lane_far, _mm_shuffle_ps(lane_far, lane_far, _MM_SHUFFLE(2, 3, 0, 1)));
+  far4 = _mm_min_ps(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(1, 0, 3, 2)));
+
+  t_near = _mm_cvtss_f32(near4);
+  t_far = _mm_cvtss_f32(far4);
+  if (t_far <= t_near)
+    return false;
+
+  entry_axis = first_lane(_mm_movemask_ps(_mm_cmpeq_ps(lane_near, near4)));
+  exit_axis = first_lane(_mm_movemask_ps(_mm_cmpeq_ps(lane_far, far4)));
   return true;
 }
 
+bool AABB::hit(const Ray& r, float t_min, float t_max) const
+{
+  float t_near, t_far;
+  int entry_axis, exit_axis;
+  return slab_hit(pos_min, pos_max, r, t_min, t_max, t_near, t_far, entry_axis, exit_axis);
+}
+
+// latitude-longitude mapping, v runs from the north pole down
+static inline void sphere_uv(HitRecord& record, float radius)
+{
+  const Vec3& n = record.normal;
+  record.u = 0.5f + atan2f(n.z, n.x) / (2 * pi);
+  record.v = acosf(fmaxf(-1.0f, fminf(1.0f, n.y))) / pi;
+  record.uv_density = 1.0f / (pi * radius);
+}
+
+// b * b - a * c of the ray sphere quadratic. Written as a * (r^2 - squared distance of the line to the center)
+// it avoids the cancellation of b * b - a * c on long rays, which accepted grazing rays well
+// outside small spheres
+static inline float sphere_discriminant(const Vec3& diff, const Vec3& direction, float a, float b, float radius)
+{
+  Vec3 offset = diff - (b / a) * direction;
+  return a * (radius * radius - Vec3::dot(offset, offset));
+}
+
 Sphere::~Sphere()
 {
   if (material_ptr)
@@ -48,34 +97,59 @@ bool Sphere::hit(const Ray& r, float t_min, float t_max, HitRecord& record) cons
   Vec3 diff = r.origin - center;
   float a = Vec3::dot(r.direction, r.direction);
   float b = Vec3::dot(diff, r.direction);
-  float c = Vec3::dot(diff, diff) - radius * radius;
-  float discriminant = b * b - a * c;
+  float discriminant = sphere_discriminant(diff, r.direction, a, b, radius);
 
   if (discriminant > 0)
   {
-    float t = (-b - sqrtf(b * b - a * c)) / a;
+    float t = (-b - sqrtf(discriminant)) / a;
     if (t < t_max && t > t_min)
     {
       record.t = t;
       record.position = r.at(t);
       record.normal = (record.position - center) / radius;
       record.material_ptr = material_ptr;
+      sphere_uv(record, radius);
       Vec3 test = record.normal.normalized();
       return true;
     }
-    t = (-b + sqrtf(b * b - a * c)) / a;
+    t = (-b + sqrtf(discriminant)) / a;
     if (t < t_max && t > t_min)
     {
       record.t = t;
       record.position = r.at(t);
       record.normal = (record.position - center) / radius;
       record.material_ptr = material_ptr;
+      sphere_uv(record, radius);
       return true;
     }
   }
   return false;
 }
 
+// shared by both sphere types, only the root test of hit without filling a record
+static bool sphere_occluded(const Vec3& center, float radius, const Ray& r, float t_min, float t_max)
+{
+  Vec3 diff = r.origin - center;
+  float a = Vec3::dot(r.direction, r.direction);
+  float b = Vec3::dot(diff, r.direction);
+  float discriminant = sphere_discriminant(diff, r.direction, a, b, radius);
+
+  if (discriminant <= 0)
+    return false;
+
+  float root = sqrtf(discriminant);
+  float t = (-b - root) / a;
+  if (t < t_max && t > t_min)
+    return true;
+  t = (-b + root) / a;
+  return t < t_max && t > t_min;
+}
+
+bool Sphere::occluded(const Ray& r, float t_min, float t_max) const
+{
+  return sphere_occluded(center, radius, r, t_min, t_max);
+}
+
 bool Sphere::bounding_box(float t0, float t1, AABB& aabb) const
 {
   aabb = AABB(center - Vec3(radius), center + Vec3(radius));
@@ -88,7 +162,70 @@ MovingSphere::~MovingSphere()
     delete material_ptr;
 }
 
+AnimatedObject::~AnimatedObject()
+{
+  if (object)
+    delete object;
+}
+
+void AnimatedObject::set_frame(float frame)
+{
+  if (keyframes.empty())
+    return;
+
+  if (frame <= keyframes.front().frame)
+  {
+    offset = keyframes.front().offset;
+    return;
+  }
+
+  for (size_t i = 1; i < keyframes.size(); ++i)
+  {
+    const Keyframe& from = keyframes[i - 1];
+    const Keyframe& to = keyframes[i];
+    if (frame < to.frame)
+    {
+      float s = (frame - from.frame) / (to.frame - from.frame);
+      offset = from.offset + s * (to.offset - from.offset);
+      return;
+    }
+  }
+  offset = keyframes.back().offset;
+}
+
+bool AnimatedObject::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  Ray moved = r;
+  moved.origin = r.origin - offset;
+  if (!object->hit(moved, t_min, t_max, record))
+    return false;
+
+  record.position += offset;
+  return true;
+}
+
+bool AnimatedObject::occluded(const Ray& r, float t_min, float t_max) const
+{
+  Ray moved = r;
+  moved.origin = r.origin - offset;
+  return object->occluded(moved, t_min, t_max);
+}
+
+bool AnimatedObject::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  if (!object->bounding_box(t0, t1, aabb))
+    return false;
+
+  aabb = AABB(aabb.pos_min + offset, aabb.pos_max + offset);
+  return true;
+}
+
 BVHnode::BVHnode(std::vector<Object*>& objects, size_t from, size_t to, float t0, float t1)
+{
+  build(objects, from, to, t0, t1);
+}
+
+void BVHnode::build(std::vector<Object*>& objects, size_t from, size_t to, float t0, float t1)
 {
   int axis = int(3 * uniform_rand());
   std::sort(objects.begin() + from, objects.begin() + to, 
@@ -124,6 +261,68 @@ BVHnode::BVHnode(std::vector<Object*>& objects, size_t from, size_t to, float t0
   right->bounding_box(t0, t1, aabb_right);
 
   aabb = aabb_left + aabb_right;
+  build_area = aabb.surface_area();
+}
+
+void BVHnode::release_children()
+{
+  if (!child_is_obj)
+  {
+    if (left)
+      delete left;
+    if (right)
+      delete right;
+  }
+  left = right = nullptr;
+  child_is_obj = true;
+}
+
+void BVHnode::refit(float t0, float t1)
+{
+  if (!child_is_obj)
+  {
+    static_cast<BVHnode*>(left)->refit(t0, t1);
+    static_cast<BVHnode*>(right)->refit(t0, t1);
+  }
+
+  AABB aabb_left, aabb_right;
+  left->bounding_box(t0, t1, aabb_left);
+  right->bounding_box(t0, t1, aabb_right);
+
+  aabb = aabb_left + aabb_right;
+}
+
+int BVHnode::rebuild_degraded(float t0, float t1, float threshold)
+{
+  if (child_is_obj)
+    return 0;
+
+  if (aabb.surface_area() > threshold * build_area)
+  {
+    std::vector<Object*> objects;
+    collect_objects(objects);
+    release_children();
+    build(objects, 0, objects.size(), t0, t1);
+    return 1;
+  }
+
+  return static_cast<BVHnode*>(left)->rebuild_degraded(t0, t1, threshold) +
+    static_cast<BVHnode*>(right)->rebuild_degraded(t0, t1, threshold);
+}
+
+void BVHnode::collect_objects(std::vector<Object*>& objects) const
+{
+  if (!child_is_obj)
+  {
+    static_cast<const BVHnode*>(left)->collect_objects(objects);
+    static_cast<const BVHnode*>(right)->collect_objects(objects);
+  }
+  else
+  {
+    objects.push_back(left);
+    if (right != left)
+      objects.push_back(right);
+  }
 }
 
 bool BVHnode::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
@@ -144,6 +343,13 @@ bool BVHnode::hit(const Ray& r, float t_min, float t_max, HitRecord& record) con
   else return false;
 }
 
+bool BVHnode::occluded(const Ray& r, float t_min, float t_max) const
+{
+  if (!aabb.hit(r, t_min, t_max))
+    return false;
+  return left->occluded(r, t_min, t_max) || (right != left && right->occluded(r, t_min, t_max));
+}
+
 bool BVHnode::bounding_box(float t0, float t1, AABB& aabb) const
 {
   aabb = this->aabb;
@@ -155,34 +361,45 @@ bool MovingSphere::hit(const Ray& r, float t_min, float t_max, HitRecord& record
   Vec3 diff = r.origin - center(r.time);
   float a = Vec3::dot(r.direction, r.direction);
   float b = Vec3::dot(diff, r.direction);
-  float c = Vec3::dot(diff, diff) - radius * radius;
-  float discriminant = b * b - a * c;
+  float discriminant = sphere_discriminant(diff, r.direction, a, b, radius);
 
   if (discriminant > 0)
   {
-    float t = (-b - sqrtf(b * b - a * c)) / a;
+    float t = (-b - sqrtf(discriminant)) / a;
     if (t < t_max && t > t_min)
     {
       record.t = t;
       record.position = r.at(t);
       record.normal = (record.position - center(r.time)) / radius;
       record.material_ptr = material_ptr;
+      sphere_uv(record, radius);
       Vec3 test = record.normal.normalized();
       return true;
     }
-    t = (-b + sqrtf(b * b - a * c)) / a;
+    t = (-b + sqrtf(discriminant)) / a;
     if (t < t_max && t > t_min)
     {
       record.t = t;
       record.position = r.at(t);
       record.normal = (record.position - center(r.time)) / radius;
       record.material_ptr = material_ptr;
+      sphere_uv(record, radius);
       return true;
     }
   }
   return false;
 }
 
+bool MovingSphere::occluded(const Ray& r, float t_min, float t_max) const
+{
+  return sphere_occluded(center(r.time), radius, r, t_min, t_max);
+}
+
+bool MovingSphere::is_moving() const
+{
+  return center_from.x != center_to.x || center_from.y != center_to.y || center_from.z != center_to.z;
+}
+
 bool MovingSphere::bounding_box(float t0, float t1, AABB& aabb) const
 {
   AABB aabb_min(center_from - Vec3(radius), center_from + Vec3(radius));
@@ -192,19 +409,231 @@ bool MovingSphere::bounding_box(float t0, float t1, AABB& aabb) const
   return true;
 }
 
-bool Lambertian::scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const
+Plane::Plane(const Vec3& point, const Vec3& normal, Material* material_ptr) : point(point), normal(normal.normalized()), material_ptr(material_ptr)
+{
+  tangent = to_world(Vec3(1, 0, 0), this->normal);
+  bitangent = to_world(Vec3(0, 1, 0), this->normal);
+}
+
+Plane::~Plane()
+{
+  if (material_ptr)
+    delete material_ptr;
+}
+
+// facing is the cosine between ray and normal, negative on the front side
+bool Plane::intersect(const Ray& r, float t_min, float t_max, float& t, float& facing) const
+{
+  facing = Vec3::dot(normal, r.direction);
+  if (fabsf(facing) < 1e-8f)
+    return false;
+
+  t = Vec3::dot(point - r.origin, normal) / facing;
+  return t < t_max && t > t_min;
+}
+
+bool Plane::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  float t, facing;
+  if (!intersect(r, t_min, t_max, t, facing))
+    return false;
+
+  record.t = t;
+  record.position = r.at(t);
+  // two sided surface, hit from either side with the normal flipped to face the ray
+  record.normal = facing < 0 ? normal : -normal;
+  record.material_ptr = material_ptr;
+
+  Vec3 offset = record.position - point;
+  record.u = Vec3::dot(offset, tangent);
+  record.v = Vec3::dot(offset, bitangent);
+  record.uv_density = 1;
+  return true;
+}
+
+bool Plane::occluded(const Ray& r, float t_min, float t_max) const
+{
+  float t, facing;
+  return intersect(r, t_min, t_max, t, facing);
+}
+
+bool Plane::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  return false;
+}
+
+Rect::Rect(const Vec3& corner, const Vec3& edge_u, const Vec3& edge_v, Material* material_ptr) :
+  corner(corner), edge_u(edge_u), edge_v(edge_v), material_ptr(material_ptr)
+{
+  Vec3 n = Vec3::cross(edge_u, edge_v);
+  normal = n.normalized();
+  plane_offset = Vec3::dot(normal, corner);
+  edge_solver = n / Vec3::dot(n, n);
+}
+
+Rect::~Rect()
+{
+  if (material_ptr)
+    delete material_ptr;
+}
+
+// alpha and beta are the hit point coordinates along edge_u and edge_v, both in [0, 1] on the rectangle
+bool Rect::intersect(const Ray& r, float t_min, float t_max, float& t, float& alpha, float& beta) const
+{
+  float facing = Vec3::dot(normal, r.direction);
+  if (fabsf(facing) < 1e-8f)
+    return false;
+
+  t = (plane_offset - Vec3::dot(normal, r.origin)) / facing;
+  if (t >= t_max || t <= t_min)
+    return false;
+
+  Vec3 offset = r.at(t) - corner;
+  alpha = Vec3::dot(edge_solver, Vec3::cross(offset, edge_v));
+  beta = Vec3::dot(edge_solver, Vec3::cross(edge_u, offset));
+  return alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1;
+}
+
+bool Rect::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  float t, alpha, beta;
+  if (!intersect(r, t_min, t_max, t, alpha, beta))
+    return false;
+
+  record.t = t;
+  record.position = r.at(t);
+  // two sided surface, hit from either side with the normal flipped to face the ray
+  record.normal = Vec3::dot(normal, r.direction) < 0 ? normal : -normal;
+  record.material_ptr = material_ptr;
+  record.u = alpha;
+  record.v = beta;
+  float length_u = edge_u.length(), length_v = edge_v.length();
+  record.uv_density = 1.0f / (length_u < length_v ? length_u : length_v);
+  return true;
+}
+
+bool Rect::occluded(const Ray& r, float t_min, float t_max) const
+{
+  float t, alpha, beta;
+  return intersect(r, t_min, t_max, t, alpha, beta);
+}
+
+bool Rect::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  const float padding = 1e-4f;
+  aabb = AABB(corner, corner) + AABB(corner + edge_u, corner + edge_u) +
+    AABB(corner + edge_v, corner + edge_v) + AABB(corner + edge_u + edge_v, corner + edge_u + edge_v);
+  // flat along the normal, give the box some thickness
+  aabb = AABB(aabb.pos_min - Vec3(padding), aabb.pos_max + Vec3(padding));
+  return true;
+}
+
+Box::~Box()
+{
+  if (material_ptr)
+    delete material_ptr;
+}
+
+bool Box::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  float t_near, t_far;
+  int entry_axis, exit_axis;
+  if (!slab_hit(pos_min, pos_max, r, t_min, t_max, t_near, t_far, entry_axis, exit_axis))
+    return false;
+
+  // from outside the ray enters through a face, from inside it leaves through one
+  int axis;
+  float outward;
+  if (entry_axis >= 0 && t_near > t_min)
+  {
+    record.t = t_near;
+    axis = entry_axis;
+    outward = r.direction[axis] > 0 ? -1.0f : 1.0f;
+  }
+  else if (exit_axis >= 0 && t_far < t_max)
+  {
+    record.t = t_far;
+    axis = exit_axis;
+    outward = r.direction[axis] > 0 ? 1.0f : -1.0f;
+  }
+  else
+    return false;
+
+  record.position = r.at(record.t);
+  record.normal = Vec3(0);
+  record.normal.data[axis] = outward;
+  record.material_ptr = material_ptr;
+  record.u = record.position[(axis + 1) % 3];
+  record.v = record.position[(axis + 2) % 3];
+  record.uv_density = 1;
+  return true;
+}
+
+bool Box::occluded(const Ray& r, float t_min, float t_max) const
+{
+  float t_near, t_far;
+  int entry_axis, exit_axis;
+  if (!slab_hit(pos_min, pos_max, r, t_min, t_max, t_near, t_far, entry_axis, exit_axis))
+    return false;
+  return (entry_axis >= 0 && t_near > t_min) || (exit_axis >= 0 && t_far < t_max);
+}
+
+bool Box::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  aabb = AABB(pos_min, pos_max);
+  return true;
+}
+
+bool SceneRoot::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  // unbounded objects first, a hit on the ground shortens the BVH traversal
+  bool hit_any = false;
+  for (auto iter = unbounded.begin(); iter != unbounded.end(); ++iter)
+    if ((*iter)->hit(r, t_min, t_max, record))
+    {
+      hit_any = true;
+      t_max = record.t;
+    }
+
+  const Object* tree = accelerator ? accelerator : bvh;
+  if (tree && tree->hit(r, t_min, t_max, record))
+    hit_any = true;
+  return hit_any;
+}
+
+bool SceneRoot::occluded(const Ray& r, float t_min, float t_max) const
+{
+  for (auto iter = unbounded.begin(); iter != unbounded.end(); ++iter)
+    if ((*iter)->occluded(r, t_min, t_max))
+      return true;
+  const Object* tree = accelerator ? accelerator : bvh;
+  return tree && tree->occluded(r, t_min, t_max);
+}
+
+bool SceneRoot::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  if (!unbounded.empty() || !bvh)
+    return false;
+  return bvh->bounding_box(t0, t1, aabb);
+}
+
+bool Lambertian::scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const
 {
-  Vec3 target = record.position + record.normal + random_in_unit_sphere();
-  scattered = Ray(record.position, target - record.position, ray_in.time);
-  attenuation = albedo;
+  float u, v;
+  sampler.next_2d(u, v);
+  scattered = Ray(record.position, to_world(cosine_sample_hemisphere(u, v), record.normal), ray_in.time);
+  attenuation = texture ? albedo * texture->value(record.u, record.v, record.footprint * record.uv_density) : albedo;
   return true;
 }
 
-bool Metal::scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const
+bool Metal::scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const
 {
   Vec3 reflected = Vec3::reflect(ray_in.direction.normalized(), record.normal);
-  scattered = Ray(record.position, reflected + (1 - metallic) * random_in_unit_sphere(), ray_in.time);
-  attenuation = albedo;
+  float u, v;
+  sampler.next_2d(u, v);
+  Vec3 fuzz = uniform_sample_ball(u, v, sampler.next_1d());
+  scattered = Ray(record.position, reflected + (1 - metallic) * fuzz, ray_in.time);
+  attenuation = texture ? albedo * texture->value(record.u, record.v, record.footprint * record.uv_density) : albedo;
   return Vec3::dot(scattered.direction, record.normal) > 0;
 }
 
@@ -215,7 +644,7 @@ static float schlick(float cos, float steepness)
   return r + (1 - r) * powf(1 - cos, 5);
 }
 
-bool Dielectric::scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const
+bool Dielectric::scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const
 {
   Vec3 outward_normal;
   Vec3 reflected = Vec3::reflect(ray_in.direction, record.normal);
@@ -244,7 +673,7 @@ bool Dielectric::scatter(const Ray& ray_in, const HitRecord& record, Vec3& atten
   {
     reflect_prob = 1;
   }
-  if (uniform_rand() < reflect_prob)
+  if (sampler.next_1d() < reflect_prob)
     scattered = Ray(record.position, reflected, ray_in.time);
   else
     scattered = Ray(record.position, refracted, ray_in.time);
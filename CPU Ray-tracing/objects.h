@@ -4,9 +4,13 @@
 #include "ray.h"
 
 #include <vector>
+#include <memory>
 #include <typeinfo>
 
 struct Material;
+struct Sampler;
+struct Texture;
+class PathGuide;
 
 struct HitRecord
 {
@@ -14,6 +18,11 @@ struct HitRecord
   Vec3 position;
   Vec3 normal;
   Material* material_ptr;
+  // surface coordinates, uv_density is uv units per world unit around the hit
+  float u, v;
+  float uv_density;
+  // world space width of the ray footprint at the hit, set by the integrator
+  float footprint = 0;
 };
 
 struct AABB
@@ -25,6 +34,7 @@ struct AABB
 
   AABB operator+(const AABB& rhs) const;
 
+  float surface_area() const;
   bool hit(const Ray& r, float t_min, float t_max) const;
 };
 
@@ -32,7 +42,13 @@ struct Object
 {
   virtual ~Object() {}
   virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const = 0;
+  // true on any intersection in (t_min, t_max), returns on the first one found
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const = 0;
   virtual bool bounding_box(float t0, float t1, AABB& aabb) const = 0;
+
+  // used to pick specialized render kernels
+  virtual bool is_moving() const { return false; }
+  virtual const Material* material() const { return nullptr; }
 };
 
 struct Sphere : public Object
@@ -46,7 +62,9 @@ struct Sphere : public Object
   ~Sphere();
 
   virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
   virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual const Material* material() const override { return material_ptr; }
 };
 
 struct MovingSphere : public Object
@@ -63,7 +81,94 @@ struct MovingSphere : public Object
 
   inline Vec3 center(float time) const { return center_from + ((time - time_from) / (time_to - time_from))*(center_to - center_from); }
   virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual bool is_moving() const override;
+  virtual const Material* material() const override { return material_ptr; }
+};
+
+// infinite plane through point, unbounded so scenes keep it out of the BVH
+struct Plane : public Object
+{
+  Vec3 point, normal;
+  Material* material_ptr = nullptr;
+
+  Plane(const Vec3& point, const Vec3& normal, Material* material_ptr);
+  ~Plane();
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual const Material* material() const override { return material_ptr; }
+
+private:
+  // uv axes, one uv unit per world unit
+  Vec3 tangent, bitangent;
+
+  bool intersect(const Ray& r, float t_min, float t_max, float& t, float& facing) const;
+};
+
+// parallelogram spanned by edge_u and edge_v from corner, a rectangle when the edges are perpendicular
+struct Rect : public Object
+{
+  Vec3 corner, edge_u, edge_v;
+  Material* material_ptr = nullptr;
+
+  Rect(const Vec3& corner, const Vec3& edge_u, const Vec3& edge_v, Material* material_ptr);
+  ~Rect();
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual const Material* material() const override { return material_ptr; }
+
+private:
+  Vec3 normal;
+  // normal scaled so dot products with it give the edge coordinates of a point
+  Vec3 edge_solver;
+  float plane_offset;
+
+  bool intersect(const Ray& r, float t_min, float t_max, float& t, float& alpha, float& beta) const;
+};
+
+// solid axis aligned box, intersected with one SIMD slab test
+struct Box : public Object
+{
+  Vec3 pos_min, pos_max;
+  Material* material_ptr = nullptr;
+
+  Box(const Vec3& pos_min, const Vec3& pos_max, Material* material_ptr) : pos_min(pos_min), pos_max(pos_max), material_ptr(material_ptr) {}
+  ~Box();
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual const Material* material() const override { return material_ptr; }
+};
+
+struct Keyframe
+{
+  float frame;
+  Vec3 offset;
+};
+
+// translates an object along linearly interpolated keyframes
+struct AnimatedObject : public Object
+{
+  Object* object = nullptr;
+  std::vector<Keyframe> keyframes;
+  Vec3 offset = Vec3(0);
+
+  inline AnimatedObject() {}
+  AnimatedObject(Object* object, const std::vector<Keyframe>& keyframes) : object(object), keyframes(keyframes) { set_frame(0); }
+  ~AnimatedObject();
+
+  void set_frame(float frame);
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
   virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+  virtual bool is_moving() const override { return object->is_moving(); }
+  virtual const Material* material() const override { return object->material(); }
 };
 
 struct BVHnode : public Object
@@ -72,58 +177,99 @@ struct BVHnode : public Object
   Object* right = nullptr;
   bool child_is_obj = true;
   AABB aabb;
+  float build_area = 0;
 
   BVHnode() {}
   BVHnode(std::vector<Object*>& objects, size_t from, size_t to, float t0, float t1);
-  inline ~BVHnode()
-  {
-    if (!child_is_obj)
-    {
-      if (left)
-        delete left;
-      if (right)
-        delete right;
-    }
-  }
+  inline ~BVHnode() { release_children(); }
 
   virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+
+  // recomputes every bound bottom-up, keeping the topology
+  void refit(float t0, float t1);
+  // rebuilds the top-most subtrees whose area grew past threshold times their build area,
+  // returns how many subtrees were rebuilt
+  int rebuild_degraded(float t0, float t1, float threshold);
+  void collect_objects(std::vector<Object*>& objects) const;
+
+private:
+  void build(std::vector<Object*>& objects, size_t from, size_t to, float t0, float t1);
+  void release_children();
+};
+
+// Everything a ray is traced against: finite objects in a BVH, and unbounded ones like planes
+// tested one by one beforehand so they neither inflate the BVH bounds nor leave it unculled.
+// owns the BVH but not the objects.
+struct SceneRoot final : public Object
+{
+  BVHnode* bvh = nullptr;
+  // traversed in place of bvh when set, a compact copy of it or a lazily built tree. owned as well
+  Object* accelerator = nullptr;
+  std::vector<Object*> unbounded;
+  // learned incident light for the guided kernel, owned by the scene
+  PathGuide* guide = nullptr;
+
+  inline SceneRoot() {}
+  inline ~SceneRoot() { if (bvh) delete bvh; if (accelerator) delete accelerator; }
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
   virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
 };
 
 // Materials
 
+enum class MaterialType
+{
+  Lambertian,
+  Metal,
+  Dielectric
+};
+
 struct Material
 {
-  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const = 0;
+  const MaterialType material_type;
+
+  inline Material(MaterialType material_type) : material_type(material_type) {}
+  virtual ~Material() {}
+  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const = 0;
 };
 
+// a texture, when set, is multiplied with albedo
 struct Lambertian : public Material
 {
   Color albedo;
+  std::shared_ptr<const Texture> texture;
 
-  inline Lambertian() {}
-  inline Lambertian(const Color& albedo) : albedo(albedo) {}
+  inline Lambertian() : Material(MaterialType::Lambertian) {}
+  inline Lambertian(const Color& albedo) : Material(MaterialType::Lambertian), albedo(albedo) {}
+  inline Lambertian(const Color& albedo, const std::shared_ptr<const Texture>& texture) : Material(MaterialType::Lambertian), albedo(albedo), texture(texture) {}
 
-  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const override;
+  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const override;
 };
 
 struct Metal : public Material
 {
   Color albedo;
   float metallic;
+  std::shared_ptr<const Texture> texture;
 
-  inline Metal() {}
-  inline Metal(const Color& albedo, float metallic) : albedo(albedo), metallic(fminf(1, metallic)) { }
+  inline Metal() : Material(MaterialType::Metal) {}
+  inline Metal(const Color& albedo, float metallic) : Material(MaterialType::Metal), albedo(albedo), metallic(fminf(1, metallic)) { }
+  inline Metal(const Color& albedo, float metallic, const std::shared_ptr<const Texture>& texture) :
+    Material(MaterialType::Metal), albedo(albedo), metallic(fminf(1, metallic)), texture(texture) { }
 
-  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const override;
+  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const override;
 };
 
 struct Dielectric : public Material
 {
   float steepness;
 
-  inline Dielectric() {}
-  inline Dielectric(float steepness) : steepness(steepness) {}
+  inline Dielectric() : Material(MaterialType::Dielectric) {}
+  inline Dielectric(float steepness) : Material(MaterialType::Dielectric), steepness(steepness) {}
 
-  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Vec3& attenuation, Ray& scattered) const override;
+  virtual bool scatter(const Ray& ray_in, const HitRecord& record, Sampler& sampler, Vec3& attenuation, Ray& scattered) const override;
 };
\ No newline at end of file
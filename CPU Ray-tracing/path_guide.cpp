@@ -0,0 +1,187 @@
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include "path_guide.h"
+#include "trace.h"
+
+// a leaf with more records in a pass is split, its children are assumed to get half each
+static const uint32_t split_record_count = 4000;
+// about 2 KB per leaf
+static const int max_leaf_count = 1 << 13;
+// share of every distribution spread over all bins, so no direction becomes impossible to draw
+static const float uniform_fraction = 0.05f;
+
+static const float four_pi = 4 * pi;
+
+static inline int bin_of(const Vec3& direction)
+{
+  const int resolution = PathGuide::bin_resolution;
+  int row = int((direction.z + 1) * 0.5f * resolution);
+  float phi = atan2f(direction.y, direction.x);
+  if (phi < 0)
+    phi += 2 * pi;
+  int column = int(phi * (resolution / (2 * pi)));
+  row = row < 0 ? 0 : row >= resolution ? resolution - 1 : row;
+  column = column < 0 ? 0 : column >= resolution ? resolution - 1 : column;
+  return row * resolution + column;
+}
+
+static inline void atomic_add(std::atomic<float>& target, float value)
+{
+  float current = target.load(std::memory_order_relaxed);
+  while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+}
+
+PathGuide::Leaf::Leaf() : record_count(0)
+{
+  for (int i = 0; i < bin_count; ++i)
+  {
+    training[i].store(0, std::memory_order_relaxed);
+    cdf[i] = (i + 1) / float(bin_count);
+  }
+}
+
+PathGuide::PathGuide(const AABB& bounds, int training_pass_count) : training_pass_count(training_pass_count)
+{
+  nodes.push_back(Node());
+  leaves.push_back(new Leaf());
+  leaves[0]->box = bounds;
+}
+
+PathGuide::~PathGuide()
+{
+  for (auto iter = leaves.begin(); iter != leaves.end(); ++iter)
+    delete *iter;
+}
+
+int PathGuide::find(const Vec3& position) const
+{
+  const Node* node = &nodes[0];
+  while (node->axis >= 0)
+    node = &nodes[node->child + (position.data[node->axis] < node->split ? 0 : 1)];
+  return node->leaf;
+}
+
+Vec3 PathGuide::sample(int leaf, float u, float v, float& pdf) const
+{
+  const float* cdf = leaves[leaf]->cdf;
+  int bin = int(std::upper_bound(cdf, cdf + bin_count, u) - cdf);
+  bin = bin < bin_count ? bin : bin_count - 1;
+
+  // u is reused for the position inside the bin
+  float low = bin > 0 ? cdf[bin - 1] : 0;
+  float probability = cdf[bin] - low;
+  float x = (u - low) / probability;
+  x = x < 0 ? 0 : x > 1 ? 1 : x;
+
+  int row = bin / bin_resolution, column = bin % bin_resolution;
+  float z = -1 + 2 * (row + v) / bin_resolution;
+  float phi = 2 * pi * (column + x) / bin_resolution;
+  float r = sqrtf(fmaxf(0.0f, 1 - z * z));
+  pdf = probability * (bin_count / four_pi);
+  return Vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+float PathGuide::pdf(int leaf, const Vec3& direction) const
+{
+  const float* cdf = leaves[leaf]->cdf;
+  int bin = bin_of(direction);
+  return (cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0)) * (bin_count / four_pi);
+}
+
+void PathGuide::record(int leaf, const Vec3& direction, float value)
+{
+  Leaf& target = *leaves[leaf];
+  target.record_count.fetch_add(1, std::memory_order_relaxed);
+  // dark paths only count towards splitting
+  if (value > 0 && value < FLT_MAX)
+    atomic_add(target.training[bin_of(direction)], value);
+}
+
+void PathGuide::refine()
+{
+  if (!training())
+    return;
+
+  TraceScope trace("guide refine", "render");
+  // leaves split off below start with the distribution just learned
+  size_t count = leaves.size();
+  for (size_t i = 0; i < count; ++i)
+  {
+    Leaf& leaf = *leaves[i];
+    uint32_t record_count = leaf.record_count.load(std::memory_order_relaxed);
+    learn(leaf);
+    split(int(i), record_count);
+  }
+  ++passes;
+}
+
+// replaces the distribution with the pass just recorded, leaves without light keep the previous one
+void PathGuide::learn(Leaf& leaf)
+{
+  float total = 0;
+  for (int i = 0; i < bin_count; ++i)
+    total += leaf.training[i].load(std::memory_order_relaxed);
+
+  if (total > 0)
+  {
+    float uniform = total * uniform_fraction / (bin_count * (1 - uniform_fraction));
+    float sum = 0;
+    for (int i = 0; i < bin_count; ++i)
+    {
+      sum += leaf.training[i].load(std::memory_order_relaxed) + uniform;
+      leaf.cdf[i] = sum;
+    }
+    for (int i = 0; i < bin_count; ++i)
+      leaf.cdf[i] /= sum;
+    leaf.cdf[bin_count - 1] = 1;
+    leaf.has_distribution = true;
+  }
+
+  for (int i = 0; i < bin_count; ++i)
+    leaf.training[i].store(0, std::memory_order_relaxed);
+  leaf.record_count.store(0, std::memory_order_relaxed);
+}
+
+// halves the leaf's box along its longest axis, the first half keeps the leaf
+void PathGuide::split(int leaf, uint32_t record_count)
+{
+  if (record_count < split_record_count || int(leaves.size()) >= max_leaf_count)
+    return;
+
+  Leaf& low = *leaves[leaf];
+  Vec3 extent = low.box.pos_max - low.box.pos_min;
+  int axis = 0;
+  for (int i = 1; i < 3; ++i)
+    if (extent.data[i] > extent.data[axis])
+      axis = i;
+
+  int node = low.node;
+  int child = int(nodes.size());
+  nodes.resize(nodes.size() + 2);
+  nodes[node].axis = axis;
+  nodes[node].split = 0.5f * (low.box.pos_min.data[axis] + low.box.pos_max.data[axis]);
+  nodes[node].child = child;
+
+  Leaf* high = new Leaf();
+  high->box = low.box;
+  high->box.pos_min.data[axis] = nodes[node].split;
+  low.box.pos_max.data[axis] = nodes[node].split;
+  std::copy(low.cdf, low.cdf + bin_count, high->cdf);
+  high->has_distribution = low.has_distribution;
+
+  low.node = child;
+  high->node = child + 1;
+  nodes[child].leaf = leaf;
+  nodes[child + 1].leaf = int(leaves.size());
+  leaves.push_back(high);
+
+  split(leaf, record_count / 2);
+  split(nodes[child + 1].leaf, record_count / 2);
+}
+
+size_t PathGuide::memory_bytes() const
+{
+  return sizeof(*this) + nodes.capacity() * sizeof(Node) + leaves.size() * (sizeof(Leaf) + sizeof(Leaf*));
+}
\ No newline at end of file
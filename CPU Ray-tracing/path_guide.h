@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "objects.h"
+
+// Learned incident radiance that diffuse bounces sample from, after Mueller et al.'s practical path guiding.
+// A kd-tree over the scene bounds holds one histogram per leaf of the light arriving from each
+// direction, in equal-area bins over (cos theta, phi) so every bin spans the same solid angle.
+// Paths record into the training histograms while tracing, from any number of threads.
+// refine runs between passes: it turns them into the distributions sample and pdf read, and
+// splits leaves that received many records in two. Once training_pass_count passes were
+// refined recording stops and the distributions stay as they are.
+class PathGuide
+{
+public:
+  static const int bin_resolution = 16;
+  static const int bin_count = bin_resolution * bin_resolution;
+
+  PathGuide(const AABB& bounds, int training_pass_count);
+  ~PathGuide();
+
+  PathGuide(const PathGuide&) = delete;
+  PathGuide& operator=(const PathGuide&) = delete;
+
+  // leaf holding position, positions outside the bounds go to the nearest leaf
+  int find(const Vec3& position) const;
+
+  // false until a refined pass recorded into the leaf or the leaf it was split from
+  inline bool has_distribution(int leaf) const { return leaves[leaf]->has_distribution; }
+  // direction drawn from the leaf's distribution, pdf is per steradian
+  Vec3 sample(int leaf, float u, float v, float& pdf) const;
+  float pdf(int leaf, const Vec3& direction) const;
+
+  inline bool training() const { return passes < training_pass_count; }
+  // radiance arriving along direction at a point of leaf, divided by the pdf direction was sampled with
+  void record(int leaf, const Vec3& direction, float value);
+  // must not run while paths trace or record
+  void refine();
+
+  inline int pass_count() const { return passes; }
+  inline int leaf_count() const { return int(leaves.size()); }
+  size_t memory_bytes() const;
+
+private:
+  struct Node
+  {
+    // -1 for leaves, otherwise the children are child and child + 1
+    int axis = -1;
+    float split = 0;
+    int child = 0;
+    int leaf = 0;
+  };
+
+  struct Leaf
+  {
+    AABB box;
+    int node = 0;
+    std::atomic<float> training[bin_count];
+    std::atomic<uint32_t> record_count;
+    // cumulative, the last bin is 1
+    float cdf[bin_count];
+    bool has_distribution = false;
+
+    Leaf();
+  };
+
+  // nodes and leaves only change in refine, tracing threads read them without locking
+  std::vector<Node> nodes;
+  std::vector<Leaf*> leaves;
+  int training_pass_count;
+  int passes = 0;
+
+  void learn(Leaf& leaf);
+  void split(int leaf, uint32_t record_count);
+};
\ No newline at end of file
@@ -0,0 +1,462 @@
+#include <math.h>
+#include <chrono>
+#include <limits>
+#include <emmintrin.h>
+
+#include "quantized_bvh.h"
+#include "randoms.h"
+
+static const uint32_t leaf_bit = 0x80000000u;
+static const uint32_t empty_child = 0xffffffffu;
+// deeper than any tree the builders make, one entry per level is ever pending
+static const int max_stack_depth = 128;
+
+// a box as two vectors, the fourth lane is free
+struct Slabs
+{
+  __m128 pos_min, pos_max;
+};
+
+static inline Slabs to_slabs(const AABB& box)
+{
+  Slabs slabs = { _mm_set_ps(0, box.pos_min.z, box.pos_min.y, box.pos_min.x), _mm_set_ps(0, box.pos_max.z, box.pos_max.y, box.pos_max.x) };
+  return slabs;
+}
+
+static inline AABB to_aabb(const Slabs& slabs)
+{
+  float pos_min[4], pos_max[4];
+  _mm_storeu_ps(pos_min, slabs.pos_min);
+  _mm_storeu_ps(pos_max, slabs.pos_max);
+  return AABB(Vec3(pos_min[0], pos_min[1], pos_min[2]), Vec3(pos_max[0], pos_max[1], pos_max[2]));
+}
+
+// Ray constants set up once per traversal. The fourth lane holds [t_min, t_max] with a unit
+// inverse direction, so the same reductions as the slab test in objects.cpp clip against the interval.
+struct RaySlabs
+{
+  __m128 origin, inv_direction;
+  __m128 t_min, t_max;
+  __m128 xyz_mask;
+
+  RaySlabs(const Ray& r, float t_min_, float t_max_)
+  {
+    origin = _mm_set_ps(0, r.origin.z, r.origin.y, r.origin.x);
+    inv_direction = _mm_div_ps(_mm_set1_ps(1), _mm_set_ps(1, r.direction.z, r.direction.y, r.direction.x));
+    xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    t_min = _mm_set_ps(t_min_, 0, 0, 0);
+    set_t_max(t_max_);
+  }
+
+  inline void set_t_max(float t) { t_max = _mm_set_ps(t, 0, 0, 0); }
+
+  inline bool hit(const Slabs& box, float& t_near) const
+  {
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_or_ps(_mm_and_ps(box.pos_min, xyz_mask), t_min), origin), inv_direction);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_or_ps(_mm_and_ps(box.pos_max, xyz_mask), t_max), origin), inv_direction);
+    __m128 lane_near = _mm_min_ps(t0, t1);
+    __m128 lane_far = _mm_max_ps(t0, t1);
+
+    __m128 near4 = _mm_max_ps(lane_near, _mm_shuffle_ps(lane_near, lane_near, _MM_SHUFFLE(2, 3, 0, 1)));
+    near4 = _mm_max_ps(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(1, 0, 3, 2)));
+    __m128 far4 = _mm_min_ps(lane_far, _mm_shuffle_ps(lane_far, lane_far, _MM_SHUFFLE(2, 3, 0, 1)));
+    far4 = _mm_min_ps(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    t_near = _mm_cvtss_f32(near4);
+    return t_near < _mm_cvtss_f32(far4);
+  }
+};
+
+// full float boxes, the frame is not needed
+template <typename Bounds>
+struct BoundsCodec
+{
+  static inline void encode(const Slabs&, const AABB& box, Bounds bounds[6])
+  {
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      bounds[axis] = box.pos_min.data[axis];
+      bounds[axis + 3] = box.pos_max.data[axis];
+    }
+  }
+
+  static inline Slabs decode(const Slabs&, const Bounds bounds[6])
+  {
+    Slabs box = { _mm_loadu_ps(bounds), _mm_set_ps(0, bounds[5], bounds[4], bounds[3]) };
+    return box;
+  }
+};
+
+// Minimums count up from the frame minimum and maximums down from the frame maximum,
+// so 0 and levels decode to the frame exactly.
+// The encoder checks its rounding with decode itself, so both always agree to the bit.
+template <typename Bounds>
+struct QuantizedCodec
+{
+  static const int levels = std::numeric_limits<Bounds>::max();
+
+  static inline Slabs decode(const Slabs& frame, const Bounds bounds[6])
+  {
+    __m128 step = _mm_mul_ps(_mm_sub_ps(frame.pos_max, frame.pos_min), _mm_set1_ps(1.0f / levels));
+    __m128 low = _mm_cvtepi32_ps(_mm_set_epi32(0, bounds[2], bounds[1], bounds[0]));
+    __m128 high = _mm_cvtepi32_ps(_mm_set_epi32(levels, levels - bounds[5], levels - bounds[4], levels - bounds[3]));
+    Slabs box = { _mm_add_ps(frame.pos_min, _mm_mul_ps(low, step)), _mm_sub_ps(frame.pos_max, _mm_mul_ps(high, step)) };
+    return box;
+  }
+
+  static inline void encode(const Slabs& frame, const AABB& box, Bounds bounds[6])
+  {
+    AABB outer = to_aabb(frame);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      float step = (outer.pos_max.data[axis] - outer.pos_min.data[axis]) * (1.0f / levels);
+      int low = 0, high = levels;
+      if (step > 0)
+      {
+        low = int(floorf((box.pos_min.data[axis] - outer.pos_min.data[axis]) / step));
+        high = levels - int(floorf((outer.pos_max.data[axis] - box.pos_max.data[axis]) / step));
+        low = low < 0 ? 0 : low > levels ? levels : low;
+        high = high < 0 ? 0 : high > levels ? levels : high;
+      }
+      bounds[axis] = Bounds(low);
+      bounds[axis + 3] = Bounds(high);
+    }
+
+    // the division above rounds either way, step outward until the decoded faces contain the box
+    for (bool contained = false; !contained;)
+    {
+      AABB decoded = to_aabb(decode(frame, bounds));
+      contained = true;
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        if (bounds[axis] > 0 && decoded.pos_min.data[axis] > box.pos_min.data[axis])
+        {
+          --bounds[axis];
+          contained = false;
+        }
+        if (bounds[axis + 3] < levels && decoded.pos_max.data[axis] < box.pos_max.data[axis])
+        {
+          ++bounds[axis + 3];
+          contained = false;
+        }
+      }
+    }
+  }
+};
+
+template <>
+struct BoundsCodec<uint16_t> : public QuantizedCodec<uint16_t> {};
+template <>
+struct BoundsCodec<uint8_t> : public QuantizedCodec<uint8_t> {};
+
+template <typename Bounds>
+FlatBVH<Bounds>::FlatBVH(const BVHnode& root, float t0, float t1)
+{
+  root_box = root.aabb;
+  flatten(root, root_box, t0, t1);
+}
+
+// frame is the decoded box of node, children are encoded against it
+template <typename Bounds>
+uint32_t FlatBVH<Bounds>::flatten(const BVHnode& node, const AABB& frame, float t0, float t1)
+{
+  uint32_t index = uint32_t(nodes.size());
+  nodes.push_back(Node());
+
+  Object* children[2] = { node.left, node.right };
+  for (int c = 0; c < 2; ++c)
+  {
+    // single object leaves repeat the object, test it once
+    if (c == 1 && node.child_is_obj && node.right == node.left)
+    {
+      for (int i = 0; i < 6; ++i)
+        nodes[index].bounds[c][i] = Bounds(0);
+      nodes[index].child[c] = empty_child;
+      continue;
+    }
+
+    // and below an inner node they are replaced by their object, saving a node and a level
+    Object* object = node.child_is_obj ? children[c] : nullptr;
+    const BVHnode* below = node.child_is_obj ? nullptr : static_cast<const BVHnode*>(children[c]);
+    if (below && below->child_is_obj && below->left == below->right)
+      object = below->left;
+
+    AABB box;
+    children[c]->bounding_box(t0, t1, box);
+    Bounds bounds[6];
+    BoundsCodec<Bounds>::encode(to_slabs(frame), box, bounds);
+
+    uint32_t child;
+    if (object)
+    {
+      child = leaf_bit | uint32_t(primitives.size());
+      primitives.push_back(object);
+    }
+    else
+    {
+      AABB decoded = to_aabb(BoundsCodec<Bounds>::decode(to_slabs(frame), bounds));
+      child = flatten(*below, decoded, t0, t1);
+    }
+
+    // nodes may have grown, index again
+    for (int i = 0; i < 6; ++i)
+      nodes[index].bounds[c][i] = bounds[i];
+    nodes[index].child[c] = child;
+  }
+  return index;
+}
+
+template <typename Bounds>
+bool FlatBVH<Bounds>::hit(const Ray& r, float t_min, float t_max, HitRecord& record) const
+{
+  struct Entry
+  {
+    Slabs frame;
+    uint32_t node;
+    float t_near;
+  };
+  Entry stack[max_stack_depth];
+  int size = 0;
+
+  RaySlabs ray(r, t_min, t_max);
+  Slabs root = to_slabs(root_box);
+  float root_near;
+  if (!ray.hit(root, root_near))
+    return false;
+  stack[size++] = { root, 0, root_near };
+
+  bool hit_any = false;
+  while (size > 0)
+  {
+    const Entry& entry = stack[--size];
+    // the closest hit may have moved in front of this subtree since it was pushed
+    if (entry.t_near >= t_max)
+      continue;
+
+    const Node& node = nodes[entry.node];
+    Slabs boxes[2];
+    float t_near[2];
+    bool hit_child[2] = { false, false };
+    for (int c = 0; c < 2; ++c)
+    {
+      if (node.child[c] == empty_child)
+        continue;
+      boxes[c] = BoundsCodec<Bounds>::decode(entry.frame, node.bounds[c]);
+      hit_child[c] = ray.hit(boxes[c], t_near[c]);
+
+      if (hit_child[c] && (node.child[c] & leaf_bit))
+      {
+        hit_child[c] = false;
+        if (primitives[node.child[c] & ~leaf_bit]->hit(r, t_min, t_max, record))
+        {
+          hit_any = true;
+          t_max = record.t;
+          ray.set_t_max(t_max);
+        }
+      }
+    }
+
+    // the far child goes below the near one so the near one is popped first
+    int near_child = hit_child[0] && hit_child[1] && t_near[1] < t_near[0] ? 1 : 0;
+    for (int i = 0; i < 2; ++i)
+    {
+      int c = i == 0 ? 1 - near_child : near_child;
+      if (hit_child[c])
+        stack[size++] = { boxes[c], node.child[c], t_near[c] };
+    }
+  }
+  return hit_any;
+}
+
+template <typename Bounds>
+bool FlatBVH<Bounds>::occluded(const Ray& r, float t_min, float t_max) const
+{
+  struct Entry
+  {
+    Slabs frame;
+    uint32_t node;
+  };
+  Entry stack[max_stack_depth];
+  int size = 0;
+
+  RaySlabs ray(r, t_min, t_max);
+  Slabs root = to_slabs(root_box);
+  float t_near;
+  if (!ray.hit(root, t_near))
+    return false;
+  stack[size++] = { root, 0 };
+
+  while (size > 0)
+  {
+    const Entry& entry = stack[--size];
+    const Node& node = nodes[entry.node];
+    Slabs frame = entry.frame;
+    for (int c = 0; c < 2; ++c)
+    {
+      if (node.child[c] == empty_child)
+        continue;
+
+      Slabs box = BoundsCodec<Bounds>::decode(frame, node.bounds[c]);
+      if (!ray.hit(box, t_near))
+        continue;
+
+      if (node.child[c] & leaf_bit)
+      {
+        if (primitives[node.child[c] & ~leaf_bit]->occluded(r, t_min, t_max))
+          return true;
+      }
+      else
+        stack[size++] = { box, node.child[c] };
+    }
+  }
+  return false;
+}
+
+template <typename Bounds>
+bool FlatBVH<Bounds>::bounding_box(float t0, float t1, AABB& aabb) const
+{
+  aabb = root_box;
+  return true;
+}
+
+template <typename Bounds>
+size_t FlatBVH<Bounds>::memory_bytes() const
+{
+  return sizeof(*this) + nodes.size() * sizeof(Node) + primitives.size() * sizeof(Object*);
+}
+
+template class FlatBVH<float>;
+template class FlatBVH<uint16_t>;
+template class FlatBVH<uint8_t>;
+
+Object* create_flat_bvh(const BVHnode& root, float t0, float t1, BVHLayout layout)
+{
+  switch (layout)
+  {
+  case BVHLayout::Flat:
+    return new FloatBVH(root, t0, t1);
+  case BVHLayout::Quantized16:
+    return new QuantizedBVH16(root, t0, t1);
+  case BVHLayout::Quantized8:
+    return new QuantizedBVH8(root, t0, t1);
+  default:
+    return nullptr;
+  }
+}
+
+// a node allocation of BVHnode, with the usual 16 bytes of allocator overhead
+static size_t node_tree_bytes(const BVHnode& node, size_t& primitive_count)
+{
+  size_t bytes = sizeof(BVHnode) + 16;
+  if (node.child_is_obj)
+    primitive_count += node.left == node.right ? 1 : 2;
+  else
+  {
+    bytes += node_tree_bytes(*static_cast<const BVHnode*>(node.left), primitive_count);
+    bytes += node_tree_bytes(*static_cast<const BVHnode*>(node.right), primitive_count);
+  }
+  return bytes;
+}
+
+template <typename Trace>
+static double rays_per_second(const std::vector<Ray>& rays, const Trace& trace)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rays.size(); ++i)
+    trace(i);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return seconds > 0 ? double(rays.size()) / seconds : 0;
+}
+
+std::vector<BVHLayoutBenchmark> benchmark_bvh_layouts(const BVHnode& root, float t0, float t1, int ray_count)
+{
+  const AABB& box = root.aabb;
+  Vec3 extent = box.pos_max - box.pos_min;
+  Vec3 center = 0.5f * (box.pos_min + box.pos_max);
+  Rng rng(1);
+
+  // coherent: one eye in front of the scene looking at a grid over the box, in scanline order
+  std::vector<Ray> coherent, incoherent;
+  int side = int(sqrtf(float(ray_count)));
+  Vec3 eye = center - Vec3(0, 0, 1.5f * extent.z + 1);
+  for (int y = 0; y < side; ++y)
+    for (int x = 0; x < side; ++x)
+    {
+      Vec3 target = box.pos_min + Vec3((x + .5f) / side * extent.x, (y + .5f) / side * extent.y, .5f * extent.z);
+      coherent.push_back(Ray(eye, target - eye, 0));
+    }
+  for (int i = 0; i < ray_count; ++i)
+  {
+    Vec3 origin = box.pos_min + Vec3(rng.next_float(), rng.next_float(), rng.next_float()) * extent;
+    Vec3 direction = uniform_sample_ball(rng.next_float(), rng.next_float(), 1);
+    incoherent.push_back(Ray(origin, direction, t0 + (t1 - t0) * rng.next_float()));
+  }
+
+  const float far = 1e30f;
+  // closest hits and occlusion segments of both sets, coherent rays first
+  std::vector<Ray> rays(coherent);
+  rays.insert(rays.end(), incoherent.begin(), incoherent.end());
+  std::vector<float> reference(rays.size()), segments(rays.size());
+  std::vector<bool> reference_occluded(rays.size());
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    HitRecord record;
+    reference[i] = root.hit(rays[i], 0.001f, far, record) ? record.t : -1;
+    segments[i] = reference[i] > 0 ? reference[i] * (0.5f + rng.next_float()) : far;
+    reference_occluded[i] = root.occluded(rays[i], 0.001f, segments[i]);
+  }
+
+  std::vector<BVHLayoutBenchmark> results;
+  const BVHLayout layouts[] = { BVHLayout::Nodes, BVHLayout::Flat, BVHLayout::Quantized16, BVHLayout::Quantized8 };
+  for (int l = 0; l < 4; ++l)
+  {
+    BVHLayoutBenchmark result;
+    result.layout = layouts[l];
+
+    Object* flat = create_flat_bvh(root, t0, t1, layouts[l]);
+    const Object& bvh = flat ? *flat : static_cast<const Object&>(root);
+
+    size_t primitive_count = 0;
+    size_t bytes = node_tree_bytes(root, primitive_count);
+    if (flat)
+    {
+      switch (layouts[l])
+      {
+      case BVHLayout::Flat:
+        bytes = static_cast<FloatBVH*>(flat)->memory_bytes();
+        break;
+      case BVHLayout::Quantized16:
+        bytes = static_cast<QuantizedBVH16*>(flat)->memory_bytes();
+        break;
+      default:
+        bytes = static_cast<QuantizedBVH8*>(flat)->memory_bytes();
+        break;
+      }
+    }
+    result.bytes_per_primitive = double(bytes) / double(primitive_count);
+
+    std::vector<float> hits(rays.size());
+    result.coherent_rays_per_second = rays_per_second(coherent, [&](size_t i)
+    {
+      HitRecord record;
+      hits[i] = bvh.hit(coherent[i], 0.001f, far, record) ? record.t : -1;
+    });
+    result.incoherent_rays_per_second = rays_per_second(incoherent, [&](size_t i)
+    {
+      HitRecord record;
+      hits[coherent.size() + i] = bvh.hit(incoherent[i], 0.001f, far, record) ? record.t : -1;
+    });
+
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+      if (hits[i] != reference[i])
+        ++result.mismatch_count;
+      if (bvh.occluded(rays[i], 0.001f, segments[i]) != reference_occluded[i])
+        ++result.occlusion_mismatch_count;
+    }
+
+    delete flat;
+    results.push_back(result);
+  }
+  return results;
+}
\ No newline at end of file
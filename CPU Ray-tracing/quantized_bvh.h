@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "objects.h"
+
+enum class BVHLayout
+{
+  // the BVHnode tree itself
+  Nodes,
+  // one array of nodes with full float child boxes
+  Flat,
+  // child boxes quantized to 16 or 8 bits inside the parent box
+  Quantized16,
+  Quantized8
+};
+
+// Binary BVH flattened into one array. A node holds the boxes of both children, stored as Bounds
+// relative to the node's own decoded box, and 32 bit child indices that either point at another node
+// or, with the top bit set, at a primitive. Quantized boxes are rounded outward and decoded from the
+// nearer side of the parent box, so a decoded box always contains the exact one.
+// Traversal is iterative and visits the nearer child first.
+template <typename Bounds>
+class FlatBVH : public Object
+{
+public:
+  // t0 and t1 are the time range the bounds cover, as for BVHnode
+  FlatBVH(const BVHnode& root, float t0, float t1);
+
+  virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& record) const override;
+  virtual bool occluded(const Ray& r, float t_min, float t_max) const override;
+  virtual bool bounding_box(float t0, float t1, AABB& aabb) const override;
+
+  size_t memory_bytes() const;
+  inline size_t primitive_count() const { return primitives.size(); }
+
+private:
+  struct Node
+  {
+    Bounds bounds[2][6];
+    uint32_t child[2];
+  };
+
+  AABB root_box;
+  std::vector<Node> nodes;
+  std::vector<Object*> primitives;
+
+  uint32_t flatten(const BVHnode& node, const AABB& frame, float t0, float t1);
+};
+
+typedef FlatBVH<float> FloatBVH;
+typedef FlatBVH<uint16_t> QuantizedBVH16;
+typedef FlatBVH<uint8_t> QuantizedBVH8;
+
+// nullptr for BVHLayout::Nodes
+Object* create_flat_bvh(const BVHnode& root, float t0, float t1, BVHLayout layout);
+
+struct BVHLayoutBenchmark
+{
+  BVHLayout layout;
+  double bytes_per_primitive = 0;
+  double coherent_rays_per_second = 0;
+  double incoherent_rays_per_second = 0;
+  // closest hits of either set differing from the BVHnode tree, anything but 0 is a bug
+  long long mismatch_count = 0;
+  // occlusion queries of either set differing from the BVHnode tree, over segments ending
+  // between half and one and a half times the distance to the closest hit
+  long long occlusion_mismatch_count = 0;
+};
+
+// Traces ray_count rays fanning out from outside the scene, and ray_count rays with random origins
+// inside it and random directions, through every layout.
+std::vector<BVHLayoutBenchmark> benchmark_bvh_layouts(const BVHnode& root, float t0, float t1, int ray_count);
\ No newline at end of file
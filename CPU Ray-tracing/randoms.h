@@ -1,6 +1,8 @@
 #pragma once
 
 #include <random>
+#include <stdint.h>
+#include <math.h>
 
 #include "vector.h"
 
@@ -9,19 +11,101 @@ inline float uniform_rand()
   return float(rand() % RAND_MAX) / RAND_MAX;
 }
 
-inline Vec3 random_in_unit_sphere()
+// integer hash (lowbias32), used to decorrelate pixels, dimensions and seeds
+inline uint32_t hash_uint(uint32_t x)
 {
-  //const float pi = 3.141592f;
-  //float theta = uniform_rand() * 2 * pi, phi = (uniform_rand() - .5f) * pi;
-  //
-  //Vec3 direction = Vec3(cosf(theta) * sinf(phi), sinf(phi), sinf(theta) * cosf(phi));
-  //return direction * uniform_rand();
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value)
+{
+  return hash_uint(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// maps 32 random bits to [0, 1)
+inline float bits_to_float(uint32_t bits)
+{
+  return (bits >> 8) * (1.0f / 16777216.0f);
+}
 
-  // original random distribution code
-  Vec3 direction;
-  do
+// small deterministic generator whose whole state can be stored and restored
+struct Rng
+{
+  uint64_t state = 0x853c49e6748fea9bull;
+
+  inline Rng() {}
+  inline Rng(uint64_t seed) { state = 0; next(); state += seed; next(); }
+
+  inline uint32_t next()
   {
-    direction = 2.0f * Vec3(uniform_rand(), uniform_rand(), uniform_rand()) - Vec3(1);
-  } while (direction.lengthSqr() >= 1.0f);
-  return direction;
+    uint64_t old_state = state;
+    state = old_state * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+    uint32_t rot = uint32_t(old_state >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  inline float next_float() { return bits_to_float(next()); }
+};
+
+// Direct mappings from [0, 1)^n to sampling domains.
+// Unlike rejection loops, each costs a fixed number of sample dimensions,
+// which keeps low-discrepancy sequences aligned across paths.
+
+// Shirley-Chiu concentric mapping, z is always 0
+inline Vec3 concentric_sample_disk(float u, float v)
+{
+  const float quarter_pi = 0.785398163f;
+  float x = 2.0f * u - 1.0f;
+  float y = 2.0f * v - 1.0f;
+
+  if (x == 0 && y == 0)
+    return Vec3(0);
+
+  float r, theta;
+  if (fabsf(x) > fabsf(y))
+  {
+    r = x;
+    theta = quarter_pi * (y / x);
+  }
+  else
+  {
+    r = y;
+    theta = 2 * quarter_pi - quarter_pi * (x / y);
+  }
+  return Vec3(r * cosf(theta), r * sinf(theta), 0);
+}
+
+// cosine weighted direction around +z
+inline Vec3 cosine_sample_hemisphere(float u, float v)
+{
+  Vec3 d = concentric_sample_disk(u, v);
+  float z = sqrtf(fmaxf(0.0f, 1.0f - d.x * d.x - d.y * d.y));
+  return Vec3(d.x, d.y, z);
+}
+
+// uniform point inside the unit ball
+inline Vec3 uniform_sample_ball(float u, float v, float w)
+{
+  const float two_pi = 6.28318531f;
+  float z = 1.0f - 2.0f * u;
+  float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+  float phi = two_pi * v;
+  return Vec3(r * cosf(phi), r * sinf(phi), z) * cbrtf(w);
+}
+
+// rotates a +z based direction so +z maps to normal (Duff et al. branchless basis)
+inline Vec3 to_world(const Vec3& local, const Vec3& normal)
+{
+  float sign = copysignf(1.0f, normal.z);
+  float a = -1.0f / (sign + normal.z);
+  float b = normal.x * normal.y * a;
+  Vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+  Vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+  return local.x * tangent + local.y * bitangent + local.z * normal;
 }
\ No newline at end of file
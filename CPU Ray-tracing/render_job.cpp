@@ -0,0 +1,166 @@
+#include <chrono>
+
+#include "render_job.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "trace.h"
+
+RenderJob::RenderJob(std::shared_ptr<const Scene> scene, const Camera& camera, const RenderJobSettings& settings, CancellationToken token) :
+  scene(scene), camera(camera), settings(settings), token(token), tiles_done(0), aborted(false)
+{
+  kernel = settings.kernel ? settings.kernel : select_kernel(detect_features(*scene, camera), settings.max_depth);
+
+  Pixel clear = { 0, 0, 0, 255 };
+  pixels.assign(size_t(settings.width) * settings.height, clear);
+}
+
+RenderStatus RenderJob::wait() const
+{
+  std::unique_lock<std::mutex> lock(security);
+  finished.wait(lock, [this]() { return state != RenderStatus::Running; });
+  return state;
+}
+
+bool RenderJob::wait_for(int milliseconds) const
+{
+  std::unique_lock<std::mutex> lock(security);
+  return finished.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() { return state != RenderStatus::Running; });
+}
+
+RenderStatus RenderJob::status() const
+{
+  std::lock_guard<std::mutex> lock(security);
+  return state;
+}
+
+void RenderJob::render_tile_task(const Tile& tile)
+{
+  if (!token.is_cancelled())
+  {
+    Sampler* sampler = create_sampler(settings.sampler_type, settings.sample_count, settings.seed);
+    std::vector<Color> colors(tile.width * tile.height);
+
+    if (render_tile(*scene->root, camera, *sampler, kernel, settings.max_depth, settings.width, settings.height,
+        tile, settings.sample_count, colors.data(), token.get()))
+    {
+      {
+        TraceScope trace("convert tile", "output", tile.x, tile.y);
+        for (int h = 0; h < tile.height; ++h)
+          for (int w = 0; w < tile.width; ++w)
+            pixels[(tile.y + h) * settings.width + tile.x + w] = to_pixel(colors[h * tile.width + w]);
+      }
+
+      if (settings.on_tile)
+        settings.on_tile(*this, tile);
+    }
+    else
+      aborted = true;
+    delete sampler;
+  }
+  else
+    aborted = true;
+
+  // cancelled tiles still count so the job completes once the queue drains
+  if (++tiles_done == tile_count)
+  {
+    std::lock_guard<std::mutex> lock(security);
+    state = aborted ? RenderStatus::Cancelled : RenderStatus::Finished;
+    finished.notify_all();
+  }
+}
+
+void RenderJob::prepare(std::vector<Tile>& tiles)
+{
+  int tiles_x = (settings.width + settings.tile_size - 1) / settings.tile_size;
+  int tiles_y = (settings.height + settings.tile_size - 1) / settings.tile_size;
+  tile_count = tiles_x * tiles_y;
+
+  if (tile_count == 0)
+  {
+    state = RenderStatus::Finished;
+    return;
+  }
+
+  tiles.reserve(tile_count);
+  for (int index = 0; index < tile_count; ++index)
+  {
+    Tile tile;
+    tile.x = (index % tiles_x) * settings.tile_size;
+    tile.y = (index / tiles_x) * settings.tile_size;
+    tile.width = settings.tile_size;
+    tile.height = settings.tile_size;
+    if (tile.x + tile.width > settings.width)
+      tile.width = settings.width - tile.x;
+    if (tile.y + tile.height > settings.height)
+      tile.height = settings.height - tile.y;
+    tiles.push_back(tile);
+  }
+}
+
+std::shared_ptr<RenderJob> start_render(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+  const Camera& camera, const RenderJobSettings& settings, CancellationToken token)
+{
+  std::shared_ptr<RenderJob> job = std::make_shared<RenderJob>(scene, camera, settings, token);
+
+  std::vector<Tile> tiles;
+  job->prepare(tiles);
+
+  // every task owns a reference, the job lives until its last tile ran
+  for (auto iter = tiles.begin(); iter != tiles.end(); ++iter)
+  {
+    Tile tile = *iter;
+    pool.submit([job, tile]() { job->render_tile_task(tile); });
+  }
+  return job;
+}
+
+RenderStatus RenderBatch::wait() const
+{
+  RenderStatus result = RenderStatus::Finished;
+  for (auto iter = views.begin(); iter != views.end(); ++iter)
+    if ((*iter)->wait() == RenderStatus::Cancelled)
+      result = RenderStatus::Cancelled;
+  return result;
+}
+
+float RenderBatch::progress() const
+{
+  if (views.empty())
+    return 1.0f;
+
+  float sum = 0;
+  for (auto iter = views.begin(); iter != views.end(); ++iter)
+    sum += (*iter)->progress();
+  return sum / views.size();
+}
+
+RenderBatch start_render_views(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+  const std::vector<Camera>& cameras, const RenderJobSettings& settings, CancellationToken token)
+{
+  RenderBatch batch;
+  batch.token = token;
+
+  std::vector<std::vector<Tile>> tiles(cameras.size());
+  size_t max_tile_count = 0;
+  for (size_t view = 0; view < cameras.size(); ++view)
+  {
+    batch.views.push_back(std::make_shared<RenderJob>(scene, cameras[view], settings, token));
+    batch.views[view]->prepare(tiles[view]);
+    if (tiles[view].size() > max_tile_count)
+      max_tile_count = tiles[view].size();
+  }
+
+  for (size_t index = 0; index < max_tile_count; ++index)
+  {
+    for (size_t view = 0; view < cameras.size(); ++view)
+    {
+      if (index >= tiles[view].size())
+        continue;
+
+      std::shared_ptr<RenderJob> job = batch.views[view];
+      Tile tile = tiles[view][index];
+      pool.submit([job, tile]() { job->render_tile_task(tile); });
+    }
+  }
+  return batch;
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "image.h"
+#include "camera.h"
+#include "renderer.h"
+#include "sampler.h"
+
+struct Scene;
+class ThreadPool;
+class RenderJob;
+struct RenderBatch;
+
+struct RenderJobSettings
+{
+  int width = 0;
+  int height = 0;
+  int sample_count = 16;
+  int max_depth = 50;
+  int tile_size = 32;
+  SamplerType sampler_type = SamplerType::Sobol;
+  uint32_t seed = 0;
+  // replaces the kernel specialized for the scene, e.g. trace_ambient_occlusion
+  RenderKernel kernel = nullptr;
+
+  // called on a worker thread after every finished tile, tiles of one job may finish concurrently
+  std::function<void(const RenderJob& job, const Tile& tile)> on_tile;
+};
+
+enum class RenderStatus
+{
+  Running,
+  Finished,
+  Cancelled
+};
+
+// shared flag, copies of a token cancel the same jobs
+class CancellationToken
+{
+private:
+  std::shared_ptr<std::atomic<bool>> flag;
+
+public:
+  inline CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+  inline void cancel() const { *flag = true; }
+  inline bool is_cancelled() const { return *flag; }
+  inline const std::atomic<bool>& get() const { return *flag; }
+};
+
+// One render of a scene, its tiles run as tasks on a shared ThreadPool.
+// Holds no global state, so any number of jobs can run at once.
+class RenderJob
+{
+private:
+  std::shared_ptr<const Scene> scene;
+  Camera camera;
+  RenderJobSettings settings;
+  CancellationToken token;
+  RenderKernel kernel;
+
+  std::vector<Pixel> pixels;
+  int tile_count = 0;
+  std::atomic<int> tiles_done;
+  // a tile was skipped or interrupted, a cancel after the last tile finished leaves the job finished
+  std::atomic<bool> aborted;
+
+  mutable std::mutex security;
+  mutable std::condition_variable finished;
+  RenderStatus state = RenderStatus::Running;
+
+  void render_tile_task(const Tile& tile);
+
+  void prepare(std::vector<Tile>& tiles);
+
+  friend std::shared_ptr<RenderJob> start_render(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+    const Camera& camera, const RenderJobSettings& settings, CancellationToken token);
+  friend RenderBatch start_render_views(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+    const std::vector<Camera>& cameras, const RenderJobSettings& settings, CancellationToken token);
+
+public:
+  // use start_render
+  RenderJob(std::shared_ptr<const Scene> scene, const Camera& camera, const RenderJobSettings& settings, CancellationToken token);
+
+  // blocks until every tile is done or the job was cancelled
+  RenderStatus wait() const;
+  // false on timeout
+  bool wait_for(int milliseconds) const;
+  RenderStatus status() const;
+
+  inline void cancel() const { token.cancel(); }
+  inline const CancellationToken& cancellation_token() const { return token; }
+  inline float progress() const { return tile_count ? float(tiles_done) / tile_count : 1.0f; }
+
+  // rows top to bottom, a partial frame while running where only finished tiles are final
+  inline const std::vector<Pixel>& image() const { return pixels; }
+  inline int width() const { return settings.width; }
+  inline int height() const { return settings.height; }
+};
+
+// The scene is shared by the job and must not change until the job is done.
+std::shared_ptr<RenderJob> start_render(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+  const Camera& camera, const RenderJobSettings& settings, CancellationToken token = CancellationToken());
+
+// views of one scene rendered together, all sharing one cancellation token
+struct RenderBatch
+{
+  std::vector<std::shared_ptr<RenderJob>> views;
+  CancellationToken token;
+
+  // Cancelled if any view was cancelled
+  RenderStatus wait() const;
+  inline void cancel() const { token.cancel(); }
+  float progress() const;
+};
+
+// Renders one image per camera in a single scheduling pass. The scene and its BVH are shared,
+// and tiles of all views are queued interleaved so no view's tail leaves workers idle.
+RenderBatch start_render_views(ThreadPool& pool, std::shared_ptr<const Scene> scene,
+  const std::vector<Camera>& cameras, const RenderJobSettings& settings, CancellationToken token = CancellationToken());
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <math.h>
+#include <utility>
+
+#include "renderer.h"
+#include "objects.h"
+#include "camera.h"
+#include "sampler.h"
+#include "scene.h"
+#include "path_guide.h"
+#include "trace.h"
+
+// depths with precompiled kernels, anything else runs the generic kernel
+static constexpr int specialized_depths[] = { 8, 50 };
+
+// cone angle added by a diffuse bounce, widens the footprint so later hits read coarse mip levels
+// and incoherent bounce rays keep touching the same few texture tiles
+static const float diffuse_spread = 0.1f;
+
+// chance a guided diffuse bounce draws from the guide rather than the cosine lobe
+static const float guide_fraction = 0.5f;
+// longest path whose radiance is recorded into the guide, longer ones still render
+static const int max_guide_vertices = 64;
+
+// a bounce of a guided path, kept until the path ends to record the light it received
+struct GuideVertex
+{
+  Color weight;
+  Vec3 direction;
+  float pdf;
+  // -1 for bounces that were not guided
+  int leaf;
+};
+
+static inline float luminance(const Color& color)
+{
+  return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+// One-sample MIS of the cosine lobe and the guide's distribution at the hit, each drawn half the time.
+// Both techniques use the same sampler dimensions. attenuation comes back as albedo * cos / pi over
+// the combined pdf, vertex gets that pdf and the leaf to record into
+static bool guided_scatter(const PathGuide& guide, const Ray& r, const HitRecord& record, Sampler& sampler, Color& attenuation, Ray& scattered, GuideVertex& vertex)
+{
+  float choice = sampler.next_1d();
+  float u, v;
+  sampler.next_2d(u, v);
+  static_cast<const Lambertian*>(record.material_ptr)->Lambertian::scatter(r, record, sampler, attenuation, scattered);
+
+  vertex.leaf = guide.find(record.position);
+  bool learned = guide.has_distribution(vertex.leaf);
+  float guide_pdf = 0;
+  if (learned && choice < guide_fraction)
+    scattered = Ray(record.position, guide.sample(vertex.leaf, u, v, guide_pdf), r.time);
+  else if (learned)
+    guide_pdf = guide.pdf(vertex.leaf, scattered.direction);
+
+  float cosine = Vec3::dot(scattered.direction, record.normal);
+  if (cosine <= 0)
+    return false;
+
+  // a cosine sample's weight is the albedo, rescale it to the pdf it was actually drawn with
+  float bsdf_pdf = cosine / pi;
+  vertex.pdf = learned ? guide_fraction * guide_pdf + (1 - guide_fraction) * bsdf_pdf : bsdf_pdf;
+  attenuation = attenuation * (bsdf_pdf / vertex.pdf);
+  return true;
+}
+
+// walks the path back from the light it ended in, recording at every guided bounce what arrived there
+static void record_path(PathGuide& guide, const GuideVertex* vertices, int vertex_count, Color incident)
+{
+  for (int i = vertex_count - 1; i >= 0; --i)
+  {
+    if (vertices[i].leaf >= 0)
+      guide.record(vertices[i].leaf, vertices[i].direction, luminance(incident) / vertices[i].pdf);
+    incident = incident * vertices[i].weight;
+  }
+}
+
+// Qualified calls bypass the vtable for materials the kernel was compiled for,
+// anything outside the mask still works through the virtual call.
+template <unsigned Features>
+static inline bool scatter(const Material* material, const Ray& r, const HitRecord& record, Sampler& sampler, Color& attenuation, Ray& scattered)
+{
+  switch (material->material_type)
+  {
+  case MaterialType::Lambertian:
+    if (Features & render_lambertian)
+      return static_cast<const Lambertian*>(material)->Lambertian::scatter(r, record, sampler, attenuation, scattered);
+    break;
+  case MaterialType::Metal:
+    if (Features & render_metal)
+      return static_cast<const Metal*>(material)->Metal::scatter(r, record, sampler, attenuation, scattered);
+    break;
+  case MaterialType::Dielectric:
+    if (Features & render_dielectric)
+      return static_cast<const Dielectric*>(material)->Dielectric::scatter(r, record, sampler, attenuation, scattered);
+    break;
+  }
+  return material->scatter(r, record, sampler, attenuation, scattered);
+}
+
+// MaxDepth of 0 reads the depth at run time. Guided kernels draw diffuse bounces from root.guide
+// and record into it while it trains
+template <unsigned Features, int MaxDepth, bool Guided>
+static Color trace_sample(const SceneRoot& root, const Camera& camera, float du, float dv, Sampler& sampler, int max_depth)
+{
+  const int depth_limit = MaxDepth > 0 ? MaxDepth : max_depth;
+  Ray r = camera.get_ray<(Features & render_depth_of_field) != 0, (Features & render_motion_blur) != 0>(du, dv, sampler);
+  Color throughput(1);
+  // the camera ray starts as a line, jittered samples already filter the first hit
+  float footprint = 0;
+  float spread = 0;
+
+  PathGuide* guide = Guided ? root.guide : nullptr;
+  bool recording = guide && guide->training();
+  GuideVertex vertices[Guided ? max_guide_vertices : 1];
+  int vertex_count = 0;
+
+  for (int depth = 0; ; ++depth)
+  {
+    HitRecord record;
+    if (!root.hit(r, t_min, t_max, record))
+    {
+      Vec3 unit = r.direction.normalized();
+      float t = .5f * (unit.y + 1.0f);
+      Color sky = (1.0f - t) * Vec3(1) + t * Vec3(.5f, .7f, 1.0f);
+      if (recording)
+        record_path(*guide, vertices, vertex_count, sky);
+      return throughput * sky;
+    }
+    footprint += spread * record.t;
+    record.footprint = footprint;
+
+    Ray scattered;
+    Color attenuation;
+    GuideVertex vertex;
+    vertex.leaf = -1;
+    vertex.pdf = 1;
+    bool guided = guide && record.material_ptr->material_type == MaterialType::Lambertian;
+    if (depth >= depth_limit ||
+        !(guided ? guided_scatter(*guide, r, record, sampler, attenuation, scattered, vertex) : scatter<Features>(record.material_ptr, r, record, sampler, attenuation, scattered)))
+      return Vec3(0);
+
+    if (recording && vertex_count == max_guide_vertices)
+      recording = false;
+    if (recording)
+    {
+      vertex.weight = attenuation;
+      vertex.direction = scattered.direction;
+      vertices[vertex_count++] = vertex;
+    }
+
+    throughput = throughput * attenuation;
+    r = scattered;
+    if (record.material_ptr->material_type == MaterialType::Lambertian)
+      spread += diffuse_spread;
+  }
+}
+
+template <int MaxDepth, size_t... Masks>
+static const RenderKernel* kernel_table(std::index_sequence<Masks...>)
+{
+  static const RenderKernel table[] = { &trace_sample<unsigned(Masks), MaxDepth, false>... };
+  return table;
+}
+
+unsigned detect_features(const Scene& scene, const Camera& camera)
+{
+  unsigned features = 0;
+  if (camera.lens_radius > 0)
+    features |= render_depth_of_field;
+
+  for (auto iter = scene.objects.begin(); iter != scene.objects.end(); ++iter)
+  {
+    if (camera.has_shutter() && (*iter)->is_moving())
+      features |= render_motion_blur;
+
+    const Material* material = (*iter)->material();
+    if (!material)
+      continue;
+
+    switch (material->material_type)
+    {
+    case MaterialType::Lambertian:
+      features |= render_lambertian;
+      break;
+    case MaterialType::Metal:
+      features |= render_metal;
+      break;
+    case MaterialType::Dielectric:
+      features |= render_dielectric;
+      break;
+    }
+  }
+  if (scene.root && scene.root->guide)
+    features |= render_path_guiding;
+  return features;
+}
+
+RenderKernel select_kernel(unsigned features, int max_depth)
+{
+  if (features & render_path_guiding)
+    return &trace_sample<render_all_features, 0, true>;
+
+  const size_t mask_count = render_all_features + 1;
+  if (max_depth == specialized_depths[0])
+    return kernel_table<specialized_depths[0]>(std::make_index_sequence<mask_count>())[features];
+  if (max_depth == specialized_depths[1])
+    return kernel_table<specialized_depths[1]>(std::make_index_sequence<mask_count>())[features];
+  return &trace_sample<render_all_features, 0, false>;
+}
+
+bool render_tile(const SceneRoot& root, const Camera& camera, Sampler& sampler, RenderKernel kernel, int max_depth,
+  int image_width, int image_height, const Tile& tile, int sample_count, Color* colors, const std::atomic<bool>& terminate_requested)
+{
+  TraceScope trace("render tile", "render", tile.x, tile.y);
+  for (int h = tile.y; h < tile.y + tile.height; ++h)
+  {
+    for (int w = tile.x; w < tile.x + tile.width; ++w)
+    {
+      Color pixel_color(0);
+
+      for (int AA_sample_iter = 0; AA_sample_iter < sample_count; ++AA_sample_iter)
+      {
+        // one path is the longest a request waits, rows can take seconds at high sample counts
+        if (terminate_requested.load(std::memory_order_relaxed))
+          return false;
+
+        float jitter_u, jitter_v;
+        sampler.start_sample(w, h, AA_sample_iter);
+        sampler.next_2d(jitter_u, jitter_v);
+
+        float du = (w + jitter_u) / float(image_width);
+        float dv = (image_height - h + jitter_v) / float(image_height);
+
+        pixel_color += kernel(root, camera, du, dv, sampler, max_depth);
+      }
+      colors[(h - tile.y) * tile.width + (w - tile.x)] = pixel_color / float(sample_count);
+    }
+  }
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+
+#include "vector.h"
+#include "ray.h"
+
+struct SceneRoot;
+struct Sampler;
+struct Scene;
+class Camera;
+
+const float t_min = 0.001f;
+const float t_max = 100000;
+
+struct Tile
+{
+  int x, y;
+  int width, height;
+};
+
+enum RenderFeature : unsigned
+{
+  render_depth_of_field = 1 << 0,
+  render_motion_blur = 1 << 1,
+  render_lambertian = 1 << 2,
+  render_metal = 1 << 3,
+  render_dielectric = 1 << 4,
+  render_all_features = (1 << 5) - 1,
+  // samples diffuse bounces from SceneRoot::guide as well, runs outside the precompiled kernels
+  render_path_guiding = 1 << 5
+};
+
+// Traces one camera sample through pixel coordinates (du, dv) and returns its radiance.
+// Kernels are specialized on a feature mask and maximum depth, features left out are compiled away.
+typedef Color (*RenderKernel)(const SceneRoot& root, const Camera& camera, float du, float dv, Sampler& sampler, int max_depth);
+
+unsigned detect_features(const Scene& scene, const Camera& camera);
+// picks the precompiled kernel for features and max_depth, or the generic one if there is none
+RenderKernel select_kernel(unsigned features, int max_depth);
+
+// Traces sample_count samples for every pixel of tile and stores the averaged linear color
+// into colors, tile rows top to bottom. termination is checked before every sample,
+// returns false if interrupted by it
+bool render_tile(const SceneRoot& root, const Camera& camera, Sampler& sampler, RenderKernel kernel, int max_depth,
+  int image_width, int image_height, const Tile& tile, int sample_count, Color* colors, const std::atomic<bool>& terminate_requested);
\ No newline at end of file
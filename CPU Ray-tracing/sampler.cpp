@@ -0,0 +1,191 @@
+#include <math.h>
+
+#include "sampler.h"
+#include "randoms.h"
+
+static uint32_t reverse_bits(uint32_t x)
+{
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// Kensler's hash based permutation of [0, length)
+static uint32_t permute(uint32_t i, uint32_t length, uint32_t p)
+{
+  uint32_t w = length - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+  do
+  {
+    i ^= p; i *= 0xe170893du;
+    i ^= p >> 16;
+    i ^= (i & w) >> 4;
+    i ^= p >> 8; i *= 0x0929eb3fu;
+    i ^= p >> 23;
+    i ^= (i & w) >> 1; i *= 1 | p >> 27;
+    i *= 0x6935fa69u;
+    i ^= (i & w) >> 11; i *= 0x74dcb303u;
+    i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+    i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= length);
+  return (i + p) % length;
+}
+
+// Laine-Karras style hash, with Burley's constants, applied on reversed bits
+// gives a nested uniform (Owen) scramble
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+  x = reverse_bits(x);
+  x ^= x * 0x3d20adeau;
+  x += seed;
+  x *= (seed >> 16) | 1;
+  x ^= x * 0x05526c56u;
+  x ^= x * 0x53a22864u;
+  return reverse_bits(x);
+}
+
+// first two Sobol dimensions: van der Corput, and the x + 1 polynomial
+static uint32_t sobol_dim0(uint32_t index)
+{
+  return reverse_bits(index);
+}
+
+static uint32_t sobol_dim1(uint32_t index)
+{
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    if (index & 1)
+      result ^= v;
+  return result;
+}
+
+static float radical_inverse(uint32_t base, uint32_t index)
+{
+  float inv_base = 1.0f / base;
+  float inv_base_n = 1.0f;
+  uint32_t reversed = 0;
+  while (index)
+  {
+    uint32_t next = index / base;
+    reversed = reversed * base + (index - next * base);
+    inv_base_n *= inv_base;
+    index = next;
+  }
+  return fminf(reversed * inv_base_n, 0.99999994f);
+}
+
+void Sampler::start_sample(int x, int y, int sample_index)
+{
+  pixel_seed = hash_combine(hash_combine(seed, uint32_t(x)), uint32_t(y));
+  this->sample_index = uint32_t(sample_index);
+  dimension = 0;
+}
+
+void RandomSampler::start_sample(int x, int y, int sample_index)
+{
+  Sampler::start_sample(x, y, sample_index);
+  rng = Rng((uint64_t(pixel_seed) << 32) | this->sample_index);
+}
+
+float RandomSampler::next_1d()
+{
+  return rng.next_float();
+}
+
+void RandomSampler::next_2d(float& u, float& v)
+{
+  u = rng.next_float();
+  v = rng.next_float();
+}
+
+StratifiedSampler::StratifiedSampler(int samples_per_pixel, uint32_t seed) : Sampler(samples_per_pixel, seed)
+{
+  strata_x = int(ceilf(sqrtf(float(samples_per_pixel))));
+  strata_y = (samples_per_pixel + strata_x - 1) / strata_x;
+}
+
+float StratifiedSampler::next_1d()
+{
+  uint32_t count = uint32_t(samples_per_pixel);
+  uint32_t pass = sample_index / count;
+  uint32_t dim_seed = hash_combine(hash_combine(pixel_seed, dimension++), pass);
+  uint32_t stratum = permute(sample_index % count, count, dim_seed);
+  float jitter = bits_to_float(hash_combine(dim_seed, sample_index));
+  return fminf((stratum + jitter) / count, 0.99999994f);
+}
+
+void StratifiedSampler::next_2d(float& u, float& v)
+{
+  uint32_t count = uint32_t(strata_x * strata_y);
+  uint32_t pass = sample_index / count;
+  uint32_t dim_seed = hash_combine(hash_combine(pixel_seed, dimension++), pass);
+  uint32_t stratum = permute(sample_index % count, count, dim_seed);
+  uint32_t jitter_seed = hash_combine(dim_seed, sample_index);
+  u = fminf((stratum % strata_x + bits_to_float(jitter_seed)) / strata_x, 0.99999994f);
+  v = fminf((stratum / strata_x + bits_to_float(hash_uint(jitter_seed))) / strata_y, 0.99999994f);
+}
+
+static const uint32_t halton_primes[] =
+{
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+};
+static const uint32_t halton_prime_count = sizeof(halton_primes) / sizeof(halton_primes[0]);
+
+float HaltonSampler::next_1d()
+{
+  uint32_t d = dimension++;
+  uint32_t dim_seed = hash_combine(pixel_seed, d);
+
+  // high bases correlate badly, fall back to random past the table
+  if (d >= halton_prime_count)
+    return bits_to_float(hash_combine(dim_seed, sample_index));
+
+  float value = radical_inverse(halton_primes[d], sample_index) + bits_to_float(dim_seed);
+  return value >= 1.0f ? value - 1.0f : value;
+}
+
+void HaltonSampler::next_2d(float& u, float& v)
+{
+  u = next_1d();
+  v = next_1d();
+}
+
+float SobolSampler::next_1d()
+{
+  uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+  uint32_t index = nested_uniform_scramble(sample_index, dim_seed);
+  return bits_to_float(nested_uniform_scramble(sobol_dim0(index), hash_uint(dim_seed)));
+}
+
+void SobolSampler::next_2d(float& u, float& v)
+{
+  uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+  uint32_t index = nested_uniform_scramble(sample_index, dim_seed);
+  u = bits_to_float(nested_uniform_scramble(sobol_dim0(index), hash_combine(dim_seed, 0)));
+  v = bits_to_float(nested_uniform_scramble(sobol_dim1(index), hash_combine(dim_seed, 1)));
+}
+
+Sampler* create_sampler(SamplerType type, int samples_per_pixel, uint32_t seed)
+{
+  switch (type)
+  {
+  case SamplerType::Stratified:
+    return new StratifiedSampler(samples_per_pixel, seed);
+  case SamplerType::Halton:
+    return new HaltonSampler(samples_per_pixel, seed);
+  case SamplerType::Sobol:
+    return new SobolSampler(samples_per_pixel, seed);
+  default:
+    return new RandomSampler(samples_per_pixel, seed);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "randoms.h"
+
+enum class SamplerType
+{
+  Random,
+  Stratified,
+  Halton,
+  Sobol
+};
+
+// Produces sample values per (pixel, sample index, dimension).
+// Every consumer asks for the next dimension in a fixed order
+// (pixel jitter, lens, time, then per bounce), so the same dimension always
+// means the same thing across all samples of a pixel.
+struct Sampler
+{
+  int samples_per_pixel;
+  uint32_t seed;
+
+  Sampler(int samples_per_pixel, uint32_t seed) : samples_per_pixel(samples_per_pixel), seed(seed) {}
+  virtual ~Sampler() {}
+
+  virtual SamplerType type() const = 0;
+  virtual void start_sample(int x, int y, int sample_index);
+  virtual float next_1d() = 0;
+  virtual void next_2d(float& u, float& v) = 0;
+
+protected:
+  uint32_t pixel_seed = 0;
+  uint32_t sample_index = 0;
+  uint32_t dimension = 0;
+};
+
+struct RandomSampler : public Sampler
+{
+  RandomSampler(int samples_per_pixel, uint32_t seed) : Sampler(samples_per_pixel, seed) {}
+
+  virtual SamplerType type() const override { return SamplerType::Random; }
+  virtual void start_sample(int x, int y, int sample_index) override;
+  virtual float next_1d() override;
+  virtual void next_2d(float& u, float& v) override;
+
+private:
+  Rng rng;
+};
+
+// jittered strata, shuffled independently for every dimension
+struct StratifiedSampler : public Sampler
+{
+  StratifiedSampler(int samples_per_pixel, uint32_t seed);
+
+  virtual SamplerType type() const override { return SamplerType::Stratified; }
+  virtual float next_1d() override;
+  virtual void next_2d(float& u, float& v) override;
+
+private:
+  int strata_x, strata_y;
+};
+
+// radical inverse per prime base, Cranley-Patterson rotated per pixel
+struct HaltonSampler : public Sampler
+{
+  HaltonSampler(int samples_per_pixel, uint32_t seed) : Sampler(samples_per_pixel, seed) {}
+
+  virtual SamplerType type() const override { return SamplerType::Halton; }
+  virtual float next_1d() override;
+  virtual void next_2d(float& u, float& v) override;
+};
+
+// Owen-scrambled Sobol (0,2)-sequence, padded across dimensions by
+// shuffling the sample index per dimension
+struct SobolSampler : public Sampler
+{
+  SobolSampler(int samples_per_pixel, uint32_t seed) : Sampler(samples_per_pixel, seed) {}
+
+  virtual SamplerType type() const override { return SamplerType::Sobol; }
+  virtual float next_1d() override;
+  virtual void next_2d(float& u, float& v) override;
+};
+
+Sampler* create_sampler(SamplerType type, int samples_per_pixel, uint32_t seed);
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+#include "scene.h"
+#include "lazy_bvh.h"
+#include "randoms.h"
+#include "texture.h"
+#include "trace.h"
+
+Scene::~Scene()
+{
+  if (root)
+    delete root;
+  if (guide)
+    delete guide;
+
+  for (auto iter = objects.begin(); iter != objects.end(); ++iter)
+    delete *iter;
+}
+
+void Scene::add(Object* object)
+{
+  objects.push_back(object);
+}
+
+void Scene::add_animated(AnimatedObject* object)
+{
+  objects.push_back(object);
+  animated_objects.push_back(object);
+}
+
+void Scene::build_bvh()
+{
+  TraceScope trace("bvh build", "scene");
+  if (root)
+    delete root;
+
+  root = new SceneRoot();
+  root->guide = guide;
+
+  // the build reorders its input, keep objects in insertion order
+  std::vector<Object*> build_objects;
+  build_objects.reserve(objects.size());
+  for (auto iter = objects.begin(); iter != objects.end(); ++iter)
+  {
+    AABB aabb;
+    if ((*iter)->bounding_box(time_from, time_to, aabb))
+      build_objects.push_back(*iter);
+    else
+      root->unbounded.push_back(*iter);
+  }
+
+  bvh_stats = BVHBuildStats();
+  if (build_objects.empty())
+    return;
+
+  if (lazy_bvh)
+  {
+    auto start = std::chrono::steady_clock::now();
+    LazyBVH* lazy = new LazyBVH(build_objects, time_from, time_to, lazy_coarse_depth);
+    root->accelerator = lazy;
+    bvh_stats.object_count = build_objects.size();
+    bvh_stats.node_count = lazy->node_count();
+    bvh_stats.thread_count = 1;
+    bvh_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return;
+  }
+
+  root->bvh = build_lbvh(build_objects, time_from, time_to, 0, &bvh_stats);
+  root->accelerator = create_flat_bvh(*root->bvh, time_from, time_to, bvh_layout);
+}
+
+int Scene::set_frame(float frame)
+{
+  for (auto iter = animated_objects.begin(); iter != animated_objects.end(); ++iter)
+    (*iter)->set_frame(frame);
+
+  if (!root || animated_objects.empty())
+    return 0;
+
+  // a lazy tree is cheaper to start over than to refit
+  if (lazy_bvh)
+  {
+    build_bvh();
+    return 0;
+  }
+
+  if (!root->bvh)
+    return 0;
+
+  TraceScope trace("bvh refit", "scene");
+
+  root->bvh->refit(time_from, time_to);
+  int rebuilt = root->bvh->rebuild_degraded(time_from, time_to, rebuild_threshold);
+
+  // the compact copy is rebuilt from the refitted tree, it cannot be refitted in place
+  if (root->accelerator)
+    delete root->accelerator;
+  root->accelerator = create_flat_bvh(*root->bvh, time_from, time_to, bvh_layout);
+  return rebuilt;
+}
+
+void Scene::enable_path_guiding(int training_pass_count)
+{
+  AABB bounds(Vec3(-1), Vec3(1));
+  bool first = true;
+  for (auto iter = objects.begin(); iter != objects.end(); ++iter)
+  {
+    AABB aabb;
+    if ((*iter)->bounding_box(time_from, time_to, aabb))
+    {
+      bounds = first ? aabb : bounds + aabb;
+      first = false;
+    }
+  }
+
+  if (guide)
+    delete guide;
+  guide = new PathGuide(bounds, training_pass_count);
+  if (root)
+    root->guide = guide;
+}
+
+uint32_t Scene::hash() const
+{
+  uint32_t result = hash_uint(uint32_t(objects.size()));
+  for (auto iter = objects.begin(); iter != objects.end(); ++iter)
+  {
+    AABB aabb;
+    if (!(*iter)->bounding_box(time_from, time_to, aabb))
+      continue;
+
+    for (int i = 0; i < 3; ++i)
+    {
+      uint32_t bits[2];
+      memcpy(&bits[0], &aabb.pos_min.data[i], sizeof(float));
+      memcpy(&bits[1], &aabb.pos_max.data[i], sizeof(float));
+      result = hash_combine(hash_combine(result, bits[0]), bits[1]);
+    }
+  }
+  return result;
+}
+
+// size x size texels of squares x squares alternating white and grey squares
+static std::shared_ptr<const Texture> checker_texture(int size, int squares)
+{
+  std::vector<Pixel> pixels(size_t(size) * size);
+  int square_size = size / squares;
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x)
+      pixels[size_t(y) * size + x] = to_pixel(Color(((x / square_size + y / square_size) & 1) ? 1.0f : 0.4f));
+  return std::make_shared<ImageTexture>(pixels.data(), size, size);
+}
+
+Scene* create_random_scene(bool lazy_bvh)
+{
+  Scene* scene = new Scene();
+  scene->lazy_bvh = lazy_bvh;
+  scene->objects.reserve(204);
+  scene->add(new Plane(Vec3(0), Vec3(0, 1, 0), new Lambertian(Vec3(0.5f))));
+
+  for(int i = 0; i < 200; ++i)
+  {
+    float choose_mat = uniform_rand();
+    Vec3 center(-9 + 18 * uniform_rand(), 0.2f, -9 + 18 * uniform_rand());
+
+    if (choose_mat < .7f)
+    {
+      scene->add(new MovingSphere(center, center + Vec3(0,.2f, 0), 0, 1, 0.2f, new Lambertian(Vec3(
+        uniform_rand()*uniform_rand(), uniform_rand()*uniform_rand(), uniform_rand()*uniform_rand()
+      ))));
+    }
+    else if (choose_mat < 0.85f)
+      scene->add(new Sphere(center, 0.2f, new Metal(Vec3(
+        0.5f * (1 + uniform_rand()), 0.5f * (1 + uniform_rand()), 0.5f * (1 + uniform_rand())
+      ), 0.5f * uniform_rand())));
+    else
+      scene->add(new Sphere(center, .2f, new Dielectric(1.5f)));
+  }
+
+  scene->add(new Sphere(Vec3(0, 1, 0), 1.0f, new Dielectric(1.5f)));
+
+  // the two outer spheres swap sides over 120 frames
+  scene->add_animated(new AnimatedObject(new Sphere(Vec3(-4, 1, 0), 1.0f, new Lambertian(Vec3(.4f, .2f, .1f), checker_texture(256, 16))),
+    { { 0, Vec3(0) }, { 60, Vec3(4, 0, 3) }, { 120, Vec3(8, 0, 0) } }));
+  scene->add_animated(new AnimatedObject(new Sphere(Vec3(4, 1, 0), 1.0f, new Metal(Vec3(.7f, .6f, .5f), 1)),
+    { { 0, Vec3(0) }, { 60, Vec3(-4, 0, -3) }, { 120, Vec3(-8, 0, 0) } }));
+
+  scene->build_bvh();
+  return scene;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "objects.h"
+#include "bvh_builder.h"
+#include "quantized_bvh.h"
+#include "path_guide.h"
+
+#include <vector>
+#include <stdint.h>
+
+struct Scene
+{
+  std::vector<Object*> objects;
+  std::vector<AnimatedObject*> animated_objects;
+  SceneRoot* root = nullptr;
+  float time_from = 0, time_to = 1;
+
+  // a subtree is rebuilt once its bounds grow past this factor of its build-time area
+  float rebuild_threshold = 2.0f;
+  // node format the BVH is traversed in, see benchmark_bvh_layouts
+  BVHLayout bvh_layout = BVHLayout::Quantized16;
+  // builds the top lazy_coarse_depth levels up front and the rest as rays reach it, see LazyBVH.
+  // for a fast first pixel on huge scenes, bvh_layout does not apply
+  bool lazy_bvh = false;
+  int lazy_coarse_depth = 4;
+
+  // diffuse bounces are sampled from it as well when set, see enable_path_guiding
+  PathGuide* guide = nullptr;
+
+  // filled by the last build_bvh
+  BVHBuildStats bvh_stats;
+
+  inline Scene() {}
+  ~Scene();
+
+  void add(Object* object);
+  void add_animated(AnimatedObject* object);
+
+  // puts the bounded objects in a BVH, objects without bounds are tested on their own
+  void build_bvh();
+  // moves animated objects to frame and refits the BVH, returns the count of rebuilt subtrees.
+  // a lazy BVH is built again instead
+  int set_frame(float frame);
+  // starts learning where light comes from over the bounded objects at the current frame,
+  // the guide trains for training_pass_count passes and replaces any earlier one
+  void enable_path_guiding(int training_pass_count);
+
+  // fingerprint of object count and bounds, used to reject checkpoints of another scene
+  uint32_t hash() const;
+};
+
+Scene* create_random_scene(bool lazy_bvh = false);
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include <math.h>
+#include <chrono>
+
+#include "texture.h"
+#include "randoms.h"
+
+static const uint32_t texture_magic = 0x58545452; // "RTTX"
+static const uint32_t texture_version = 1;
+
+static const size_t cache_shard_count = 16;
+
+// interleaves the 3 bit x and y inside a tile
+static inline int morton_index(int x, int y)
+{
+  int index = 0;
+  for (int bit = 0; bit < 3; ++bit)
+    index |= (((x >> bit) & 1) << (2 * bit)) | (((y >> bit) & 1) << (2 * bit + 1));
+  return index;
+}
+
+// decoded texel components, inverse of to_pixel
+static const struct DecodeTable
+{
+  float values[256];
+
+  DecodeTable()
+  {
+    for (int i = 0; i < 256; ++i)
+      values[i] = (i / 255.0f) * (i / 255.0f);
+  }
+} decode_table;
+
+static inline Color decode(const Pixel& pixel)
+{
+  return Color(decode_table.values[pixel.r], decode_table.values[pixel.g], decode_table.values[pixel.b]);
+}
+
+size_t MipmappedTexture::tile_count() const
+{
+  const MipLevel& last = levels.back();
+  return last.first_tile + size_t(last.tiles_x) * last.tiles_y;
+}
+
+void MipmappedTexture::layout(int width, int height)
+{
+  levels.clear();
+  size_t first_tile = 0;
+  while (true)
+  {
+    MipLevel level;
+    level.width = width;
+    level.height = height;
+    level.tiles_x = (width + texture_tile_size - 1) / texture_tile_size;
+    level.tiles_y = (height + texture_tile_size - 1) / texture_tile_size;
+    level.first_tile = first_tile;
+    levels.push_back(level);
+    first_tile += size_t(level.tiles_x) * level.tiles_y;
+
+    if (width == 1 && height == 1)
+      break;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+}
+
+Color MipmappedTexture::value(float u, float v, float footprint) const
+{
+  // level where one texel covers the footprint
+  float texels = footprint * float(levels[0].width > levels[0].height ? levels[0].width : levels[0].height);
+  int level_index = texels > 1 ? int(log2f(texels)) : 0;
+  if (level_index >= int(levels.size()))
+    level_index = int(levels.size()) - 1;
+  const MipLevel& level = levels[level_index];
+
+  float x = (u - floorf(u)) * level.width - 0.5f;
+  float y = (v - floorf(v)) * level.height - 0.5f;
+  float x_floor = floorf(x);
+  float y_floor = floorf(y);
+  float fx = x - x_floor;
+  float fy = y - y_floor;
+
+  int x0 = (int(x_floor) + level.width) % level.width;
+  int y0 = (int(y_floor) + level.height) % level.height;
+  int x1 = x0 + 1 < level.width ? x0 + 1 : 0;
+  int y1 = y0 + 1 < level.height ? y0 + 1 : 0;
+
+  auto texel = [&](int tx, int ty)
+  {
+    size_t tile = level.first_tile + size_t(ty / texture_tile_size) * level.tiles_x + tx / texture_tile_size;
+    return decode(fetch(tile, morton_index(tx % texture_tile_size, ty % texture_tile_size)));
+  };
+
+  Color top = (1 - fx) * texel(x0, y0) + fx * texel(x1, y0);
+  Color bottom = (1 - fx) * texel(x0, y1) + fx * texel(x1, y1);
+  return (1 - fy) * top + fy * bottom;
+}
+
+ImageTexture::ImageTexture(const Pixel* pixels, int width, int height)
+{
+  layout(width, height);
+  tiled_texels.resize(tile_count() * texture_tile_texels);
+
+  // filter in linear space, every level is a 2x2 box of the previous one
+  std::vector<Color> colors(size_t(width) * height);
+  for (size_t i = 0; i < colors.size(); ++i)
+    colors[i] = decode(pixels[i]);
+
+  for (size_t l = 0; l < levels.size(); ++l)
+  {
+    const MipLevel& level = levels[l];
+    if (l > 0)
+    {
+      const MipLevel& parent = levels[l - 1];
+      std::vector<Color> reduced(size_t(level.width) * level.height);
+      for (int y = 0; y < level.height; ++y)
+        for (int x = 0; x < level.width; ++x)
+        {
+          int px0 = 2 * x < parent.width ? 2 * x : parent.width - 1;
+          int py0 = 2 * y < parent.height ? 2 * y : parent.height - 1;
+          int px1 = px0 + 1 < parent.width ? px0 + 1 : px0;
+          int py1 = py0 + 1 < parent.height ? py0 + 1 : py0;
+          reduced[size_t(y) * level.width + x] = 0.25f * (colors[size_t(py0) * parent.width + px0] + colors[size_t(py0) * parent.width + px1] +
+            colors[size_t(py1) * parent.width + px0] + colors[size_t(py1) * parent.width + px1]);
+        }
+      colors.swap(reduced);
+    }
+
+    for (int y = 0; y < level.height; ++y)
+      for (int x = 0; x < level.width; ++x)
+      {
+        size_t tile = level.first_tile + size_t(y / texture_tile_size) * level.tiles_x + x / texture_tile_size;
+        tiled_texels[tile * texture_tile_texels + morton_index(x % texture_tile_size, y % texture_tile_size)] = to_pixel(colors[size_t(y) * level.width + x]);
+      }
+  }
+}
+
+Pixel ImageTexture::fetch(size_t tile, int texel) const
+{
+  return tiled_texels[tile * texture_tile_texels + texel];
+}
+
+template <typename T>
+static void write_value(std::ofstream& file, const T& value)
+{
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool read_value(std::ifstream& file, T& value)
+{
+  return bool(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+bool write_texture(const char* path, const ImageTexture& texture)
+{
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+
+  write_value(file, texture_magic);
+  write_value(file, texture_version);
+  write_value(file, texture.width());
+  write_value(file, texture.height());
+  file.write(reinterpret_cast<const char*>(texture.texels().data()), texture.texels().size() * sizeof(Pixel));
+  return bool(file);
+}
+
+TextureCache::TextureCache(size_t capacity_bytes) : shards(cache_shard_count)
+{
+  slots_per_shard = capacity_bytes / (sizeof(Slot) * cache_shard_count);
+  if (slots_per_shard < 1)
+    slots_per_shard = 1;
+
+  for (auto iter = shards.begin(); iter != shards.end(); ++iter)
+  {
+    iter->slots.resize(slots_per_shard);
+    iter->lookup.reserve(slots_per_shard);
+  }
+}
+
+uint32_t TextureCache::register_texture()
+{
+  std::lock_guard<std::mutex> lock(registry_security);
+  return next_texture_id++;
+}
+
+void TextureCache::statistics(long long& hits, long long& misses)
+{
+  hits = 0;
+  misses = 0;
+  for (auto iter = shards.begin(); iter != shards.end(); ++iter)
+  {
+    std::lock_guard<std::mutex> lock(iter->mutex);
+    hits += iter->hits;
+    misses += iter->misses;
+  }
+}
+
+size_t TextureCache::evict(Shard& shard)
+{
+  while (true)
+  {
+    size_t index = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.slots.size();
+
+    Slot& slot = shard.slots[index];
+    if (!slot.used)
+      return index;
+    if (slot.referenced)
+      slot.referenced = false;
+    else
+    {
+      shard.lookup.erase(slot.key);
+      slot.used = false;
+      return index;
+    }
+  }
+}
+
+Pixel TextureCache::texel(const StreamedTexture& texture, size_t tile, int texel)
+{
+  uint64_t key = (uint64_t(texture.id()) << 40) | tile;
+  Shard& shard = shards[hash_combine(uint32_t(key >> 32), uint32_t(key)) % shards.size()];
+
+  // a miss reads from disk under the shard lock, other shards keep serving meanwhile
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.lookup.find(key);
+  if (found != shard.lookup.end())
+  {
+    ++shard.hits;
+    Slot& slot = shard.slots[found->second];
+    slot.referenced = true;
+    return slot.texels[texel];
+  }
+
+  ++shard.misses;
+  size_t index = evict(shard);
+  Slot& slot = shard.slots[index];
+  if (!texture.read_tile(tile, slot.texels))
+  {
+    Pixel missing;
+    missing.r = missing.b = missing.a = 255;
+    missing.g = 0;
+    for (int i = 0; i < texture_tile_texels; ++i)
+      slot.texels[i] = missing;
+  }
+  slot.key = key;
+  slot.used = true;
+  slot.referenced = true;
+  shard.lookup[key] = index;
+  return slot.texels[texel];
+}
+
+StreamedTexture::StreamedTexture(TextureCache& cache, const std::string& path) :
+  cache(cache), texture_id(cache.register_texture()), file(path, std::ios::binary)
+{
+  uint32_t magic, version;
+  int width, height;
+  if (!read_value(file, magic) || magic != texture_magic)
+    return;
+  if (!read_value(file, version) || version != texture_version)
+    return;
+  if (!read_value(file, width) || !read_value(file, height) || width <= 0 || height <= 0)
+    return;
+
+  data_offset = file.tellg();
+  layout(width, height);
+}
+
+bool StreamedTexture::read_tile(size_t tile, Pixel* texels) const
+{
+  std::lock_guard<std::mutex> lock(file_security);
+  file.clear();
+  file.seekg(data_offset + std::streamoff(tile) * std::streamoff(texture_tile_texels * sizeof(Pixel)));
+  return bool(file.read(reinterpret_cast<char*>(texels), texture_tile_texels * sizeof(Pixel)));
+}
+
+Pixel StreamedTexture::fetch(size_t tile, int texel) const
+{
+  return cache.texel(*this, tile, texel);
+}
+
+TextureBenchmark benchmark_texture(const Texture& texture, int fetch_count, float footprint, uint32_t seed)
+{
+  Rng rng(seed);
+  Color sum(0);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < fetch_count; ++i)
+  {
+    float u = rng.next_float();
+    float v = rng.next_float();
+    sum += texture.value(u, v, footprint);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  // keeps the lookups from being optimized away
+  volatile float sink = sum.r + sum.g + sum.b;
+  (void)sink;
+
+  TextureBenchmark result;
+  result.texel_count = 4ll * fetch_count;
+  double seconds = std::chrono::duration<double>(end - start).count();
+  if (seconds > 0)
+    result.texels_per_second = double(result.texel_count) / seconds;
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#include "vector.h"
+#include "image.h"
+
+struct Texture
+{
+  virtual ~Texture() {}
+  // footprint is the width of the lookup in uv units, wider lookups read coarser mip levels
+  virtual Color value(float u, float v, float footprint) const = 0;
+};
+
+struct ConstantTexture : public Texture
+{
+  Color color;
+
+  inline ConstantTexture(const Color& color) : color(color) {}
+
+  virtual Color value(float u, float v, float footprint) const override { return color; }
+};
+
+// texels are grouped in square tiles, a tile of Pixels is 256 bytes
+const int texture_tile_size = 8;
+const int texture_tile_texels = texture_tile_size * texture_tile_size;
+
+struct MipLevel
+{
+  int width, height;
+  int tiles_x, tiles_y;
+  size_t first_tile;
+};
+
+// Texels are Morton ordered inside a tile and tiles are row major per level,
+// so a bilinear lookup touches one tile, rarely up to four, instead of two image rows.
+// Lookups are bilinear on the level whose texels match the footprint, u and v wrap.
+class MipmappedTexture : public Texture
+{
+public:
+  virtual Color value(float u, float v, float footprint) const override;
+
+  inline int width() const { return levels[0].width; }
+  inline int height() const { return levels[0].height; }
+  inline int level_count() const { return int(levels.size()); }
+  size_t tile_count() const;
+
+protected:
+  std::vector<MipLevel> levels;
+
+  // fills levels for a width x height base level, down to 1x1
+  void layout(int width, int height);
+  virtual Pixel fetch(size_t tile, int texel) const = 0;
+};
+
+// whole mip chain in memory, gamma 2 encoded like the display output
+class ImageTexture : public MipmappedTexture
+{
+public:
+  // pixels are row major, rows top to bottom
+  ImageTexture(const Pixel* pixels, int width, int height);
+
+  inline const std::vector<Pixel>& texels() const { return tiled_texels; }
+
+protected:
+  virtual Pixel fetch(size_t tile, int texel) const override;
+
+private:
+  std::vector<Pixel> tiled_texels;
+};
+
+// writes the tiled mip chain so StreamedTexture can read single tiles of it
+bool write_texture(const char* path, const ImageTexture& texture);
+
+class StreamedTexture;
+
+// Fixed budget of decoded tiles shared by any number of streamed textures.
+// Misses read the tile from its file, CLOCK eviction keeps recently used tiles.
+// Tiles are spread over independently locked shards so render threads rarely contend.
+class TextureCache
+{
+public:
+  TextureCache(size_t capacity_bytes);
+
+  Pixel texel(const StreamedTexture& texture, size_t tile, int texel);
+
+  uint32_t register_texture();
+  inline size_t capacity_tiles() const { return shards.size() * slots_per_shard; }
+  void statistics(long long& hits, long long& misses);
+
+private:
+  struct Slot
+  {
+    uint64_t key = 0;
+    bool used = false;
+    bool referenced = false;
+    Pixel texels[texture_tile_texels];
+  };
+
+  struct Shard
+  {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, size_t> lookup;
+    std::vector<Slot> slots;
+    size_t hand = 0;
+    long long hits = 0;
+    long long misses = 0;
+  };
+
+  std::vector<Shard> shards;
+  size_t slots_per_shard;
+  std::mutex registry_security;
+  uint32_t next_texture_id = 0;
+
+  size_t evict(Shard& shard);
+};
+
+// Mip chain read tile by tile from a write_texture file through a TextureCache,
+// so only the cache budget is resident no matter how large the texture is.
+class StreamedTexture : public MipmappedTexture
+{
+public:
+  StreamedTexture(TextureCache& cache, const std::string& path);
+
+  // false if the file could not be opened or is not a texture file
+  inline bool valid() const { return !levels.empty(); }
+  inline uint32_t id() const { return texture_id; }
+  // fills texels with the tile from disk, called by the cache on a miss
+  bool read_tile(size_t tile, Pixel* texels) const;
+
+protected:
+  virtual Pixel fetch(size_t tile, int texel) const override;
+
+private:
+  TextureCache& cache;
+  uint32_t texture_id;
+  std::streamoff data_offset = 0;
+  mutable std::ifstream file;
+  mutable std::mutex file_security;
+};
+
+struct TextureBenchmark
+{
+  long long texel_count = 0;
+  double texels_per_second = 0;
+};
+
+// Looks up fetch_count uniformly random uvs with the given footprint, the access pattern
+// of diffuse bounces. every bilinear lookup counts as four texels.
+TextureBenchmark benchmark_texture(const Texture& texture, int fetch_count, float footprint, uint32_t seed);
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int thread_count)
+{
+  if (thread_count <= 0)
+    thread_count = int(std::thread::hardware_concurrency());
+  if (thread_count <= 0)
+    thread_count = 1;
+
+  for (int i = 0; i < thread_count; ++i)
+    threads.push_back(std::thread(&ThreadPool::worker_loop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  security.lock();
+  quit = true;
+  security.unlock();
+  wake.notify_all();
+
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+    iter->join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+  security.lock();
+  tasks.push_back(std::move(task));
+  security.unlock();
+  wake.notify_one();
+}
+
+void ThreadPool::worker_loop()
+{
+  std::unique_lock<std::mutex> lock(security);
+  for (;;)
+  {
+    wake.wait(lock, [this]() { return quit || !tasks.empty(); });
+    if (tasks.empty())
+      return;
+
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
\ No newline at end of file
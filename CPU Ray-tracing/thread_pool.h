@@ -0,0 +1,34 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+// Fixed set of workers running tasks in submission order.
+// Any number of render jobs can share one pool, their tiles interleave in the queue.
+class ThreadPool
+{
+private:
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> tasks;
+  std::mutex security;
+  std::condition_variable wake;
+  bool quit = false;
+
+  void worker_loop();
+
+public:
+  // 0 uses every hardware thread
+  explicit ThreadPool(int thread_count = 0);
+  // runs what is still queued before returning
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void submit(std::function<void()> task);
+  inline int size() const { return int(threads.size()); }
+};
\ No newline at end of file
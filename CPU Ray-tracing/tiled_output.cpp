@@ -0,0 +1,118 @@
+#include <thread>
+#include <vector>
+
+#include "tiled_output.h"
+#include "trace.h"
+
+TiledPPMWriter::TiledPPMWriter(const char* path, int width, int height) : width(width), height(height)
+{
+  // an empty image stays closed, there is nothing to reserve
+  std::streamoff data_size = std::streamoff(width) * height * 3;
+  if (width <= 0 || height <= 0 || data_size <= 0)
+    return;
+
+  file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file)
+    return;
+
+  file << "P6\n" << width << " " << height << "\n255\n";
+  data_offset = file.tellp();
+
+  // reserve the whole file so tiles can be written in any order
+  file.seekp(data_offset + data_size - 1);
+  file.put(0);
+}
+
+bool TiledPPMWriter::write_tile(const Tile& tile, const Pixel* pixels)
+{
+  std::vector<char> row(tile.width * 3);
+
+  std::lock_guard<std::mutex> lock(security);
+  for (int h = 0; h < tile.height; ++h)
+  {
+    for (int w = 0; w < tile.width; ++w)
+    {
+      const Pixel& pixel = pixels[h * tile.width + w];
+      row[w * 3 + 0] = char(pixel.r);
+      row[w * 3 + 1] = char(pixel.g);
+      row[w * 3 + 2] = char(pixel.b);
+    }
+    file.seekp(data_offset + (std::streamoff(tile.y + h) * width + tile.x) * 3);
+    file.write(row.data(), row.size());
+  }
+  return bool(file);
+}
+
+bool render_tiled_to_file(const SceneRoot& root, const Camera& camera, const TiledRenderSettings& settings,
+  const char* path, const std::atomic<bool>& terminate_requested)
+{
+  TiledPPMWriter writer(path, settings.width, settings.height);
+  if (!writer.is_open())
+    return false;
+
+  int tiles_x = (settings.width + settings.tile_size - 1) / settings.tile_size;
+  int tiles_y = (settings.height + settings.tile_size - 1) / settings.tile_size;
+  int tile_count = tiles_x * tiles_y;
+
+  int thread_count = settings.thread_count;
+  if (thread_count <= 0)
+    thread_count = int(std::thread::hardware_concurrency());
+  if (thread_count <= 0)
+    thread_count = 1;
+
+  RenderKernel kernel = settings.kernel ? settings.kernel : select_kernel(settings.features, settings.max_depth);
+
+  // tiles are handed out in scanline order so writes stay close together in the file
+  std::atomic<int> next_tile(0);
+  std::atomic<bool> failed(false);
+
+  auto worker = [&]()
+  {
+    Sampler* sampler = create_sampler(settings.sampler_type, settings.sample_count, 0);
+    std::vector<Color> colors(settings.tile_size * settings.tile_size);
+    std::vector<Pixel> pixels(colors.size());
+
+    for (int index = next_tile++; index < tile_count && !failed; index = next_tile++)
+    {
+      Tile tile;
+      tile.x = (index % tiles_x) * settings.tile_size;
+      tile.y = (index / tiles_x) * settings.tile_size;
+      tile.width = settings.tile_size;
+      tile.height = settings.tile_size;
+      if (tile.x + tile.width > settings.width)
+        tile.width = settings.width - tile.x;
+      if (tile.y + tile.height > settings.height)
+        tile.height = settings.height - tile.y;
+
+      if (!render_tile(root, camera, *sampler, kernel, settings.max_depth, settings.width, settings.height,
+        tile, settings.sample_count, colors.data(), terminate_requested))
+      {
+        failed = true;
+        break;
+      }
+
+      {
+        TraceScope trace("convert tile", "output", tile.x, tile.y);
+        for (int i = 0; i < tile.width * tile.height; ++i)
+          pixels[i] = to_pixel(colors[i]);
+      }
+
+      TraceScope trace("write tile", "output", tile.x, tile.y);
+      if (!writer.write_tile(tile, pixels.data()))
+      {
+        failed = true;
+        break;
+      }
+    }
+
+    delete sampler;
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < thread_count; ++i)
+    threads.push_back(std::thread(worker));
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+    iter->join();
+
+  return !failed;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <atomic>
+
+#include "image.h"
+#include "renderer.h"
+#include "sampler.h"
+
+// Binary PPM written tile by tile. The file is sized up front and every tile row
+// goes straight to its final offset, so only tiles in flight are kept in memory.
+class TiledPPMWriter
+{
+private:
+  std::fstream file;
+  std::streamoff data_offset = 0;
+  int width, height;
+  std::mutex security;
+
+public:
+  TiledPPMWriter(const char* path, int width, int height);
+
+  inline bool is_open() const { return file.is_open(); }
+  bool write_tile(const Tile& tile, const Pixel* pixels);
+};
+
+struct TiledRenderSettings
+{
+  int width = 0;
+  int height = 0;
+  int sample_count = 1;
+  int max_depth = 50;
+  unsigned features = render_all_features;
+  int tile_size = 64;
+  // 0 uses every hardware thread
+  int thread_count = 0;
+  SamplerType sampler_type = SamplerType::Sobol;
+  // replaces the kernel specialized for features, e.g. trace_ambient_occlusion
+  RenderKernel kernel = nullptr;
+};
+
+// Renders on worker threads that each own a single tile buffer, streaming finished tiles to path.
+// Peak memory is thread_count * tile_size^2 pixels regardless of the image size.
+bool render_tiled_to_file(const SceneRoot& root, const Camera& camera, const TiledRenderSettings& settings,
+  const char* path, const std::atomic<bool>& terminate_requested);
\ No newline at end of file
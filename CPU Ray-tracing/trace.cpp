@@ -0,0 +1,160 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+struct TraceEvent
+{
+  const char* name;
+  const char* category;
+  int x, y;
+  int64_t begin_ns;
+  int64_t duration_ns;
+};
+
+// Events live in chunks that never move, so a reader can walk them while the owning thread appends.
+// count is published after the event is written, readers only look below it.
+struct ThreadTraceBuffer
+{
+  static const size_t chunk_size = 4096;
+  static const size_t max_chunks = 1024;
+
+  int thread_id;
+  std::atomic<TraceEvent*> chunks[max_chunks];
+  std::atomic<size_t> count;
+
+  ThreadTraceBuffer(int thread_id) : thread_id(thread_id), count(0)
+  {
+    for (size_t i = 0; i < max_chunks; ++i)
+      chunks[i] = nullptr;
+  }
+
+  ~ThreadTraceBuffer()
+  {
+    for (size_t i = 0; i < max_chunks; ++i)
+      delete[] chunks[i].load();
+  }
+
+  // only called by the owning thread, events past the last chunk are dropped
+  void append(const TraceEvent& event)
+  {
+    size_t index = count.load(std::memory_order_relaxed);
+    size_t chunk = index / chunk_size;
+    if (chunk >= max_chunks)
+      return;
+
+    TraceEvent* events = chunks[chunk].load(std::memory_order_relaxed);
+    if (!events)
+    {
+      events = new TraceEvent[chunk_size];
+      chunks[chunk].store(events, std::memory_order_release);
+    }
+    events[index % chunk_size] = event;
+    count.store(index + 1, std::memory_order_release);
+  }
+};
+
+static std::atomic<bool> enabled(false);
+static std::chrono::steady_clock::time_point epoch;
+
+// buffers outlive their threads so a trace can be written after workers exit
+static std::mutex registry_security;
+static std::vector<ThreadTraceBuffer*> registry;
+
+static struct RegistryCleanup
+{
+  ~RegistryCleanup()
+  {
+    for (auto iter = registry.begin(); iter != registry.end(); ++iter)
+      delete *iter;
+  }
+} registry_cleanup;
+
+static thread_local ThreadTraceBuffer* thread_buffer = nullptr;
+
+static ThreadTraceBuffer* current_buffer()
+{
+  if (!thread_buffer)
+  {
+    std::lock_guard<std::mutex> lock(registry_security);
+    thread_buffer = new ThreadTraceBuffer(int(registry.size()) + 1);
+    registry.push_back(thread_buffer);
+  }
+  return thread_buffer;
+}
+
+static inline int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void enable_tracing()
+{
+  if (enabled)
+    return;
+  epoch = std::chrono::steady_clock::now();
+  enabled.store(true, std::memory_order_release);
+}
+
+bool tracing_enabled()
+{
+  return enabled.load(std::memory_order_acquire);
+}
+
+TraceScope::TraceScope(const char* name, const char* category, int x, int y) :
+  name(name), category(category), x(x), y(y), begin_ns(0), active(tracing_enabled())
+{
+  if (active)
+    begin_ns = now_ns();
+}
+
+TraceScope::~TraceScope()
+{
+  if (!active)
+    return;
+
+  TraceEvent event = { name, category, x, y, begin_ns, now_ns() - begin_ns };
+  current_buffer()->append(event);
+}
+
+bool write_chrome_trace(const char* path)
+{
+  std::vector<ThreadTraceBuffer*> buffers;
+  {
+    std::lock_guard<std::mutex> lock(registry_security);
+    buffers = registry;
+  }
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file)
+    return false;
+
+  // timestamps are in microseconds, kept to nanosecond precision
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  file.setf(std::ios::fixed);
+  file.precision(3);
+
+  bool first = true;
+  for (auto iter = buffers.begin(); iter != buffers.end(); ++iter)
+  {
+    const ThreadTraceBuffer& buffer = **iter;
+    size_t count = buffer.count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+      const TraceEvent& event = buffer.chunks[i / ThreadTraceBuffer::chunk_size].load(std::memory_order_acquire)[i % ThreadTraceBuffer::chunk_size];
+      file << (first ? "\n" : ",\n");
+      first = false;
+
+      file << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.thread_id
+        << ",\"ts\":" << event.begin_ns * 1e-3 << ",\"dur\":" << event.duration_ns * 1e-3;
+      if (event.x >= 0 || event.y >= 0)
+        file << ",\"args\":{\"x\":" << event.x << ",\"y\":" << event.y << "}";
+      file << "}";
+    }
+  }
+  file << "\n]}\n";
+  return bool(file);
+}
\ No newline at end of file
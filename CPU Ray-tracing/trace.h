@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timeline of scoped events, off unless enable_tracing is called.
+// Every thread appends to its own buffer without locks, a buffer is only registered once
+// per thread, so the cost of an event is two clock reads and a store.
+// Event names and categories must be string literals, they are kept by pointer.
+
+void enable_tracing();
+bool tracing_enabled();
+
+// writes every event recorded so far as Chrome trace JSON, open it in Perfetto or chrome://tracing.
+// can be called while other threads keep recording
+bool write_chrome_trace(const char* path);
+
+// records the time from construction to destruction on the calling thread,
+// x and y are shown as event arguments when not negative
+class TraceScope
+{
+public:
+  TraceScope(const char* name, const char* category, int x = -1, int y = -1);
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name;
+  const char* category;
+  int x, y;
+  int64_t begin_ns;
+  bool active;
+};
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+const float pi = 3.141592f;
+
 union Vec3
 {
   float data[3];
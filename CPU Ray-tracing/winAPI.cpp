@@ -4,12 +4,30 @@
 #include <stdlib.h>
 #include <thread>
 #include <mutex>
+#include <stdio.h>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
 
 #include "winAPI.h"
 #include "vector.h"
 #include "ray.h"
 #include "objects.h"
 #include "randoms.h"
+#include "sampler.h"
+#include "scene.h"
+#include "image.h"
+#include "camera.h"
+#include "film.h"
+#include "renderer.h"
+#include "tiled_output.h"
+#include "checkpoint.h"
+#include "render_job.h"
+#include "thread_pool.h"
+#include "ambient_occlusion.h"
+#include "texture.h"
+#include "trace.h"
+#include "batch_runner.h"
 
 #if defined(DEBUG) | defined(_DEBUG)
 #define CRTDBG_MAP_ALLOC
@@ -34,20 +52,37 @@ static void UpdateClientRect(const HWND& hwnd);
 static void Render(const HWND& hwnd);
 static void RequestThreadRendering(HDC& temp_hdc, unsigned char clear_value);
 static void thread_renderer();
+static void ParseCommandLine(LPSTR command_line);
+static void OrbitCamera(WPARAM key);
 
 struct WinAPI winAPI;
 struct Frame shared_frame;
 struct ThreadData shared_thread_data;
+struct RenderSettings render_settings;
 
 static LARGE_INTEGER fixed_frequency;
 const float framerate_target_dt = .016f;
-const float t_min = 0.001f;
-const float t_max = 100000;
-
-int CALLBACK WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR, int)
+const int interactive_samples_per_pass = 4;
+const int reprojection_max_history = 128;
+const float orbit_angle_step = pi / 36;
+const float orbit_distance_step = .5f;
+const float orbit_pan_step = .5f;
+// coarsest preview draws one sample per block of this many pixels squared
+const int preview_block_size = 16;
+const float checkpoint_interval = 60.0f;
+// passes the path guide learns from, later passes only sample it
+const int guide_training_passes = 8;
+
+int CALLBACK WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR command_line, int)
 {
   DEBUG_LEAK_CHECKS(-1);
 
+  ParseCommandLine(command_line);
+
+  Vec3 camera_pos(10, 2, -3);
+  float camera_theta = pi * .9f, camera_phi = -pi * .05f, focus_dist = 7;
+  shared_thread_data.camera_orbit = { camera_pos + Camera::look_direction(camera_theta, camera_phi) * focus_dist, camera_theta, camera_phi, focus_dist };
+
   winAPI.window_handle = InitializeWindow(h_instance);
   winAPI.instance_handle = h_instance;
   if (!winAPI.window_handle) return 0;
@@ -80,9 +115,68 @@ int CALLBACK WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR, int)
     last_frame_time = current_time;
   }
 
+  // the renderer traces and logs through statics of other files, stop it before they are destroyed
+  shared_thread_data.stop();
   return 0;
 }
 
+// --spp <count> and --depth <max depth> set the sample budget per pixel, at least 1 sample and depth 0
+// --ao renders ambient occlusion through the any-hit query
+// --frames <from> <to> renders an animation sequence to frame_####.ppm
+// --poster <width> <height> <path> streams a large render to a PPM file
+// --turntable <views> renders views around the orbit target in one batch
+// --checkpoint <path> saves progress periodically to <path>.<width>x<height>, --resume continues from it
+// --texture-benchmark logs texture fetch throughput before rendering
+// --bvh-benchmark logs memory and traversal speed of every BVH layout before rendering
+// --occlusion-benchmark logs any-hit and closest-hit throughput of ambient occlusion rays before rendering
+// --lazy-bvh splits the BVH only where rays go, for a fast first pixel on huge scenes
+// --guiding learns incident light over the first passes and guides diffuse bounces with it,
+//   interactive and sequence renders only
+// --batch <path> renders every job of a job list, see load_batch_jobs
+// --trace <path> records a timeline and writes it as Chrome trace JSON whenever rendering stops
+void ParseCommandLine(LPSTR command_line)
+{
+  std::istringstream args(command_line);
+  std::string arg;
+  while (args >> arg)
+  {
+    if (arg == "--spp" && args >> render_settings.sample_count)
+      render_settings.sample_count = render_settings.sample_count < 1 ? 1 : render_settings.sample_count;
+    else if (arg == "--depth" && args >> render_settings.max_depth)
+      render_settings.max_depth = render_settings.max_depth < 0 ? 0 : render_settings.max_depth;
+    else if (arg == "--ao")
+      render_settings.ambient_occlusion = true;
+    else if (arg == "--frames" && args >> render_settings.frame_from >> render_settings.frame_to)
+      render_settings.sequence = true;
+    else if (arg == "--poster" && args >> render_settings.poster_width >> render_settings.poster_height >> render_settings.poster_path)
+    {
+      render_settings.poster = render_settings.poster_width > 0 && render_settings.poster_height > 0;
+      if (!render_settings.poster)
+        OutputDebugStringA("--poster needs a positive width and height, rendering interactively\n");
+    }
+    else if (arg == "--turntable")
+      args >> render_settings.turntable_views;
+    else if (arg == "--checkpoint")
+      args >> render_settings.checkpoint_path;
+    else if (arg == "--resume")
+      render_settings.resume = true;
+    else if (arg == "--texture-benchmark")
+      render_settings.texture_benchmark = true;
+    else if (arg == "--bvh-benchmark")
+      render_settings.bvh_benchmark = true;
+    else if (arg == "--occlusion-benchmark")
+      render_settings.occlusion_benchmark = true;
+    else if (arg == "--lazy-bvh")
+      render_settings.lazy_bvh = true;
+    else if (arg == "--guiding")
+      render_settings.path_guiding = true;
+    else if (arg == "--batch")
+      args >> render_settings.batch_path;
+    else if (arg == "--trace" && args >> render_settings.trace_path)
+      enable_tracing();
+  }
+}
+
 Time CurrentTime()
 {
   LARGE_INTEGER result;
@@ -162,6 +256,10 @@ LRESULT CALLBACK MainWindowCallback(HWND hwnd, UINT u_msg, WPARAM w_param, LPARA
   case WM_ERASEBKGND:
     return 1;
 
+  case WM_KEYDOWN:
+    OrbitCamera(w_param);
+    break;
+
   default:
     return DefWindowProc(hwnd, u_msg, w_param, l_param);
   }
@@ -169,6 +267,55 @@ LRESULT CALLBACK MainWindowCallback(HWND hwnd, UINT u_msg, WPARAM w_param, LPARA
   return 0;
 }
 
+// arrow keys orbit around the focus point, page up/down dolly, W/A/S/D pan the focus point along the ground
+void OrbitCamera(WPARAM key)
+{
+  if (render_settings.sequence)
+    return;
+
+  shared_thread_data.camera_security.lock();
+  CameraOrbit& orbit = shared_thread_data.camera_orbit;
+  bool moved = true;
+  switch (key)
+  {
+  case VK_LEFT:
+    orbit.theta -= orbit_angle_step;
+    break;
+  case VK_RIGHT:
+    orbit.theta += orbit_angle_step;
+    break;
+  case VK_UP:
+    orbit.phi = fminf(orbit.phi + orbit_angle_step, pi * .45f);
+    break;
+  case VK_DOWN:
+    orbit.phi = fmaxf(orbit.phi - orbit_angle_step, -pi * .45f);
+    break;
+  case VK_PRIOR:
+    orbit.distance = fmaxf(orbit.distance - orbit_distance_step, orbit_distance_step);
+    break;
+  case VK_NEXT:
+    orbit.distance += orbit_distance_step;
+    break;
+  case 'W':
+  case 'S':
+  case 'A':
+  case 'D':
+  {
+    Vec3 forward = Camera::look_direction(orbit.theta, 0);
+    Vec3 right = Vec3::cross(Vec3(0, 1, 0), forward);
+    Vec3 pan = key == 'W' ? forward : key == 'S' ? -forward : key == 'D' ? right : -right;
+    orbit.target += pan * orbit_pan_step;
+    break;
+  }
+  default:
+    moved = false;
+  }
+  shared_thread_data.camera_security.unlock();
+
+  if (moved)
+    shared_thread_data.camera_moved = true;
+}
+
 void UpdateClientRect(const HWND& hwnd)
 {
   POINT p;
@@ -202,6 +349,22 @@ void Render(const HWND& hwnd)
   EndPaint(hwnd, &paint_struct);
 }
 
+// reallocates the frame buffer at the bitmap's size and clears it
+static void AllocateFrame(const BITMAP& bmp, unsigned char clear_value)
+{
+  delete[] shared_frame.pixel_buffer;
+
+  shared_frame.pixel_buffer = new Pixel[bmp.bmHeight * bmp.bmWidthBytes / 4];
+
+  shared_frame.width = bmp.bmWidth;
+  shared_frame.height = bmp.bmHeight;
+  shared_frame.stride = bmp.bmWidthBytes;
+
+  // clear the frame
+  for (int i = 0; i < shared_frame.width * shared_frame.height; ++i)
+    shared_frame.pixel_buffer[i] = { clear_value, clear_value, clear_value, 255 };
+}
+
 void RequestThreadRendering(HDC& temp_hdc, unsigned char clear_value)
 {
   winAPI.hdc = CreateCompatibleDC(temp_hdc);
@@ -220,6 +383,14 @@ void RequestThreadRendering(HDC& temp_hdc, unsigned char clear_value)
       shared_frame.stride == bmp.bmWidthBytes)
     return;
 
+  // Posters and batches do not depend on the window size, let them run. The frame still follows
+  // the bitmap for Render, neither touches it but the renderer holds data_security until it is done
+  if ((render_settings.poster || shared_thread_data.batch_running) && shared_thread_data.thread_renderer.joinable())
+  {
+    AllocateFrame(bmp, clear_value);
+    return;
+  }
+
   // requests current rendering termination
   shared_thread_data.terminate_requested = true;
 
@@ -227,53 +398,34 @@ void RequestThreadRendering(HDC& temp_hdc, unsigned char clear_value)
   if (shared_thread_data.thread_renderer.joinable())
     shared_thread_data.thread_renderer.join();
 
-  // reallocate the frame buffer
   shared_thread_data.data_security.lock();
-
-  delete[] shared_frame.pixel_buffer;
-
-  shared_frame.pixel_buffer = new Pixel[bmp.bmHeight * bmp.bmWidthBytes / 4];
-
-  shared_frame.width = bmp.bmWidth;
-  shared_frame.height = bmp.bmHeight;
-  shared_frame.stride = bmp.bmWidthBytes;
-
-  // clear the frame
-  for (int i = 0; i < shared_frame.width * shared_frame.height; ++i)
-    shared_frame.pixel_buffer[i] = { clear_value, clear_value, clear_value, 255 };
-
+  AllocateFrame(bmp, clear_value);
   shared_thread_data.data_security.unlock();
 
   shared_thread_data.terminate_requested = false;
+  // set before the thread starts so a resize right after cannot restart the batch
+  shared_thread_data.batch_running = !render_settings.batch_path.empty();
 
   // run rendering
   shared_thread_data.thread_renderer = std::thread(thread_renderer);
 }
 
-Camera::Camera(const Vec3& position, float theta, float phi, float focus_dist, float time_from, float time_to) : position(position), focus_dist(focus_dist), time_from(time_from), time_to(time_to)
+void ThreadData::stop()
 {
-  look = { cosf(phi) * cosf(theta), tanf(phi), cosf(phi) * sinf(theta) };
-
-  float tan_half_fov = tanf(pi / 12) * focus_dist;
-  float resolution_ratio = shared_frame.height / float(shared_frame.width);
+  terminate_requested = true;
 
-  Vec3 quad_center = position + look * focus_dist;
-  Vec3 right_hand = Vec3(look.z, 0, -look.x);
+  // if rendering, request termination
+  if (thread_renderer.joinable())
+    thread_renderer.join();
 
-  right = Vec3::cross(Vec3(0,1,0), look);
-  up = Vec3::cross(look, right);
+  // writes the checkpoint of the last render before exiting
+  delete checkpoint_writer;
+  checkpoint_writer = nullptr;
+}
 
-  if (resolution_ratio < 1)
-  {
-    horizontal = Vec3::cross(Vec3(0, 1, 0), look) * tan_half_fov * 2 / resolution_ratio;
-    vertical = Vec3::cross(look, right_hand) * tan_half_fov * 2;
-  }
-  else
-  {
-    horizontal = Vec3::cross(Vec3(0, 1, 0), look) * tan_half_fov * 2;
-    vertical = Vec3::cross(look, right_hand) * tan_half_fov * 2 * resolution_ratio;
-  }
-  bottom_left = quad_center - horizontal * .5f - vertical * .5f;
+ThreadData::~ThreadData()
+{
+  stop();
 }
 
 bool BoundingBox(const std::vector<Object*>& objects, float t0, float t1, AABB& aabb)
@@ -291,113 +443,593 @@ bool BoundingBox(const std::vector<Object*>& objects, float t0, float t1, AABB&
   return true;
 }
 
-Vec3 Camera::random_in_unit_disk()
+static CameraOrbit TakeCameraOrbit()
 {
-  Vec3 p;
-  do
-  {
-    p = 2.0f * Vec3(uniform_rand(), uniform_rand(), 0) - Vec3(1, 0, 0);
-  } while (Vec3::dot(p, p) >= 1.0f);
-  return p;
+  shared_thread_data.camera_security.lock();
+  CameraOrbit orbit = shared_thread_data.camera_orbit;
+  shared_thread_data.camera_moved = false;
+  shared_thread_data.camera_security.unlock();
+  return orbit;
 }
 
-Ray Camera::get_ray(float du, float dv)
+static Camera CurrentCamera(float resolution_ratio)
 {
-  Vec3 rd = lens_radius * random_in_unit_disk();
-  Vec3 offset = right * rd.x + up * rd.y;
-  return Ray(position + offset,
-    bottom_left + du * horizontal + dv * vertical - position - offset,
-    time_from + uniform_rand() * (time_to - time_from));
+  return TakeCameraOrbit().make_camera(resolution_ratio);
 }
 
-Color compute_raycast(BVHnode& bvhnode, const Ray& r, int depth)
+// interactive work stops for a resize, a close or a camera move
+static bool interactive_interrupted()
 {
-  HitRecord record;
-  bool is_hit = bvhnode.hit(r, t_min, t_max, record);
+  return shared_thread_data.terminate_requested.load(std::memory_order_relaxed) ||
+    shared_thread_data.camera_moved.load(std::memory_order_relaxed);
+}
 
-  if (is_hit)
+// returns false if interrupted
+static bool trace_first_hits(Film& film, const SceneRoot& root, const Camera& camera)
+{
+  TraceScope trace("first hits", "render");
+  for (int h = 0; h < film.height; ++h)
   {
-    Ray scattered;
-    Color attenuation;
-    if (depth < 50 && record.material_ptr->scatter(r, record, attenuation, scattered))
-      return attenuation * compute_raycast(bvhnode, scattered, depth + 1);
-    return Vec3(0);
+    if (interactive_interrupted())
+      return false;
+
+    for (int w = 0; w < film.width; ++w)
+    {
+      int index = h * film.width + w;
+      Ray r = camera.get_center_ray((w + .5f) / film.width, (film.height - h + .5f) / film.height);
+
+      HitRecord record;
+      if (root.hit(r, t_min, t_max, record))
+      {
+        film.depth[index] = record.t;
+        film.position[index] = record.position;
+      }
+      else
+      {
+        film.depth[index] = INFINITY;
+        film.position[index] = r.direction;
+      }
+    }
   }
+  return true;
+}
 
-  Vec3 unit_dir = r.direction.normalized();
-  float t = .5f * (unit_dir.y + 1.0f);
-  return (1.0f - t) * Vec3(1) + t * Vec3(.5f, .7f, 1.0f);
+static void publish_row(const Film& film, int h)
+{
+  TraceScope trace("publish row", "display", 0, h);
+  for (int w = 0; w < film.width; ++w)
+  {
+    int index = h * film.width + w;
+    Pixel pixel = to_pixel(film.resolve(index));
+    shared_frame.pixel_buffer[index].r = pixel.r;
+    shared_frame.pixel_buffer[index].g = pixel.g;
+    shared_frame.pixel_buffer[index].b = pixel.b;
+  }
 }
 
-void thread_renderer()
+static void trace_sample(Film& film, const SceneRoot& root, const Camera& camera, Sampler& sampler, RenderKernel kernel, int w, int h)
 {
-  int n = 204;
-  std::vector<Object*> objects;
-  objects.reserve(n);
-  objects.push_back(new Sphere(Vec3(0,-1000,0), 1000, new Lambertian(Vec3(0.5f))));
-   
-  for(int i = 0; i < 200; ++i)
+  int index = h * film.width + w;
+  float jitter_u, jitter_v;
+  sampler.start_sample(w, h, film.sample_count[index]);
+  sampler.next_2d(jitter_u, jitter_v);
+
+  float du = (w + jitter_u) / float(film.width);
+  float dv = (film.height - h + jitter_v) / float(film.height);
+
+  film.add_sample(index, kernel(root, camera, du, dv, sampler, render_settings.max_depth));
+}
+
+// Coarse to fine first look at pixels without history: one sample per block drawn over the
+// block's empty pixels, halving the block size down to 2x2. the samples stay in the film.
+// returns false if interrupted
+static bool render_preview(Film& film, const SceneRoot& root, const Camera& camera, Sampler& sampler, RenderKernel kernel)
+{
+  TraceScope trace("preview", "render");
+  for (int block = preview_block_size; block > 1; block /= 2)
   {
-    float choose_mat = uniform_rand();
-    Vec3 center(-9 + 18 * uniform_rand(), 0.2f, -9 + 18 * uniform_rand());
-      
-    if (choose_mat < .7f)
+    for (int h = 0; h < film.height; h += block)
     {
-      objects.push_back(new MovingSphere(center, center + Vec3(0,.2f, 0), 0, 1, 0.2f, new Lambertian(Vec3(
-        uniform_rand()*uniform_rand(), uniform_rand()*uniform_rand(), uniform_rand()*uniform_rand()
-      ))));
+      if (interactive_interrupted())
+        return false;
+
+      for (int w = 0; w < film.width; w += block)
+      {
+        int index = h * film.width + w;
+        if (film.sample_count[index] == 0)
+          trace_sample(film, root, camera, sampler, kernel, w, h);
+
+        Pixel pixel = to_pixel(film.resolve(index));
+        for (int y = h; y < h + block && y < film.height; ++y)
+          for (int x = w; x < w + block && x < film.width; ++x)
+            if (film.sample_count[y * film.width + x] == 0)
+            {
+              Pixel& target = shared_frame.pixel_buffer[y * film.width + x];
+              target.r = pixel.r;
+              target.g = pixel.g;
+              target.b = pixel.b;
+            }
+      }
     }
-    else if (choose_mat < 0.85f)
-      objects.push_back(new Sphere(center, 0.2f, new Metal(Vec3(
-        0.5f * (1 + uniform_rand()), 0.5f * (1 + uniform_rand()), 0.5f * (1 + uniform_rand())
-      ), 0.5f * uniform_rand())));
-    else
-      objects.push_back(new Sphere(center, .2f, new Dielectric(1.5f)));
   }
-  
-  objects.push_back(new Sphere(Vec3(0, 1, 0), 1.0f, new Dielectric(1.5f)));
-  objects.push_back(new Sphere(Vec3(-4, 1, 0), 1.0f, new Lambertian(Vec3(.4f, .2f, .1f))));
-  objects.push_back(new Sphere(Vec3(4, 1, 0), 1.0f, new Metal(Vec3(.7f, .6f, .5f), 1)));
-  
-  BVHnode root(objects, 0, objects.size(), t_min, t_max);
+  return true;
+}
 
-  shared_thread_data.data_security.lock();
-  Vec3 camera_pos(10, 2, -3);
-  Camera camera(camera_pos, pi * .9f, -pi * .05f, 7, 0, 1);
-  camera.lens_radius = 0.08f;
+// Adds up to samples_per_pass samples to every pixel below sample_count.
+// returns false if the pass was interrupted by a termination request or a camera move,
+// which are checked every pixel so neither waits for more than samples_per_pass paths
+static bool render_pass(Film& film, const SceneRoot& root, const Camera& camera, Sampler& sampler, RenderKernel kernel, int samples_per_pass, int sample_count)
+{
+  TraceScope trace("render pass", "render");
+  for (int h = 0; h < film.height; ++h)
+  {
+    for (int w = 0; w < film.width; ++w)
+    {
+      if (interactive_interrupted())
+        return false;
+
+      int index = h * film.width + w;
+      int sample_from = film.sample_count[index];
+      int sample_to = sample_from + samples_per_pass;
+      if (sample_to > sample_count)
+        sample_to = sample_count;
+
+      for (int AA_sample_iter = sample_from; AA_sample_iter < sample_to; ++AA_sample_iter)
+        trace_sample(film, root, camera, sampler, kernel, w, h);
+    }
+    publish_row(film, h);
+  }
+  return true;
+}
+
+static void LogOcclusionBenchmark(const OcclusionBenchmark& benchmark)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "occlusion rays: %lld, any-hit: %.2f Mrays/s, closest-hit: %.2f Mrays/s, mismatches: %lld\n",
+    benchmark.ray_count, benchmark.any_hit_rays_per_second * 1e-6, benchmark.closest_hit_rays_per_second * 1e-6, benchmark.mismatch_count);
+  OutputDebugStringA(message);
+}
+
+static void LogBVHBuild(const BVHBuildStats& stats)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "bvh build: %zu objects, %zu nodes, %d threads, %.2f ms\n",
+    stats.object_count, stats.node_count, stats.thread_count, stats.seconds * 1e3);
+  OutputDebugStringA(message);
+}
+
+static void LogPathGuide(const PathGuide& guide)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "path guide: %d passes learned, %d leaves, %zu KB%s\n",
+    guide.pass_count(), guide.leaf_count(), guide.memory_bytes() / 1024, guide.training() ? "" : ", training done");
+  OutputDebugStringA(message);
+}
 
-  for (int h = 0; h < shared_frame.height; ++h)
+static void LogTextureBenchmark(const char* name, const TextureBenchmark& benchmark)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "%s: %lld texels, %.2f Mtexels/s\n", name, benchmark.texel_count, benchmark.texels_per_second * 1e-6);
+  OutputDebugStringA(message);
+}
+
+// incoherent lookups into a 4096x4096 texture, resident and streamed through a cache a quarter of its size
+static void RunTextureBenchmark()
+{
+  const int size = 4096;
+  const int fetch_count = 1 << 22;
+  const char* path = "texture_benchmark.rttx";
+
+  std::vector<Pixel> pixels(size_t(size) * size);
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x)
+      pixels[size_t(y) * size + x] = to_pixel(Color(x / float(size), y / float(size), bits_to_float(hash_combine(uint32_t(x), uint32_t(y)))));
+
+  ImageTexture resident(pixels.data(), size, size);
+  pixels.clear();
+  pixels.shrink_to_fit();
+  LogTextureBenchmark("resident texture, finest level", benchmark_texture(resident, fetch_count, 0, 1));
+  LogTextureBenchmark("resident texture, 1/64 footprint", benchmark_texture(resident, fetch_count, 1.0f / 64, 1));
+
+  if (!write_texture(path, resident))
+    return;
   {
-    if (shared_thread_data.terminate_requested)
+    TextureCache cache(resident.texels().size() * sizeof(Pixel) / 4);
+    StreamedTexture streamed(cache, path);
+    if (streamed.valid())
     {
-      for (auto iter = objects.begin(); iter != objects.end(); ++iter)
-        delete *iter;
-      shared_thread_data.data_security.unlock();
-      return;
+      LogTextureBenchmark("streamed texture, finest level", benchmark_texture(streamed, fetch_count, 0, 1));
+      LogTextureBenchmark("streamed texture, 1/64 footprint", benchmark_texture(streamed, fetch_count, 1.0f / 64, 1));
+
+      long long hits, misses;
+      cache.statistics(hits, misses);
+      char message[256];
+      snprintf(message, sizeof(message), "texture cache: %zu tiles, %lld hits, %lld misses\n", cache.capacity_tiles(), hits, misses);
+      OutputDebugStringA(message);
     }
+  }
+  remove(path);
+}
+
+// a million small spheres, far more nodes than fit in cache
+static void RunBVHBenchmark()
+{
+  const int sphere_count = 1000000;
+  const int ray_count = 1 << 18;
+  const char* names[] = { "nodes", "flat", "quantized 16", "quantized 8" };
+
+  std::vector<Object*> spheres;
+  spheres.reserve(sphere_count);
+  Rng rng(1);
+  for (int i = 0; i < sphere_count; ++i)
+    spheres.push_back(new Sphere(Vec3(rng.next_float(), rng.next_float(), rng.next_float()) * 100, 0.05f + 0.3f * rng.next_float(), nullptr));
+
+  BVHnode* root = build_lbvh(spheres, 0, 1, 0, nullptr);
+  std::vector<BVHLayoutBenchmark> results = benchmark_bvh_layouts(*root, 0, 1, ray_count);
+  for (auto iter = results.begin(); iter != results.end(); ++iter)
+  {
+    char message[256];
+    snprintf(message, sizeof(message), "bvh %s: %.1f bytes per primitive, %.2f Mrays/s coherent, %.2f Mrays/s incoherent, %lld hit and %lld occlusion mismatches\n",
+      names[int(iter->layout)], iter->bytes_per_primitive, iter->coherent_rays_per_second * 1e-6, iter->incoherent_rays_per_second * 1e-6,
+      iter->mismatch_count, iter->occlusion_mismatch_count);
+    OutputDebugStringA(message);
+  }
+
+  delete root;
+  for (auto iter = spheres.begin(); iter != spheres.end(); ++iter)
+    delete *iter;
+}
 
-    for (int w = 0; w < shared_frame.width; ++w)
+// 4 ambient occlusion rays per pixel of the window, from the startup camera
+static void RunOcclusionBenchmark(Scene& scene)
+{
+  scene.set_frame(0);
+  Camera camera = CurrentCamera(shared_frame.height / float(shared_frame.width));
+  LogOcclusionBenchmark(benchmark_occlusion(*scene.root, camera, shared_frame.width, shared_frame.height, 4));
+}
+
+// one checkpoint per image size, the render a resize restarts cannot overwrite the one before it
+static std::string CheckpointPath(int width, int height)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%dx%d", width, height);
+  return render_settings.checkpoint_path + suffix;
+}
+
+// progressive passes, camera moves reproject what was accumulated so far into the new view
+static void render_interactive(Scene& scene, Sampler& sampler, int sample_count)
+{
+  float resolution_ratio = shared_frame.height / float(shared_frame.width);
+  scene.set_frame(0);
+
+  Film film(shared_frame.width, shared_frame.height);
+
+  Checkpoint checkpoint;
+  std::string checkpoint_path;
+  if (!render_settings.checkpoint_path.empty())
+  {
+    checkpoint_path = CheckpointPath(film.width, film.height);
+    const char* path = checkpoint_path.c_str();
+    if (render_settings.resume &&
+        load_checkpoint(path, checkpoint) &&
+        checkpoint.scene_hash == scene.hash() &&
+        checkpoint.sampler_type == sampler.type() &&
+        checkpoint.sampler_seed == sampler.seed &&
+        checkpoint.restore(film))
     {
-      Color pixel_color(0);
+      shared_thread_data.camera_security.lock();
+      shared_thread_data.camera_orbit = checkpoint.camera_orbit;
+      shared_thread_data.camera_security.unlock();
+    }
+    if (!shared_thread_data.checkpoint_writer)
+      shared_thread_data.checkpoint_writer = new CheckpointWriter();
+  }
+
+  CameraOrbit orbit = TakeCameraOrbit();
+  Camera camera = orbit.make_camera(resolution_ratio);
+  RenderKernel kernel = select_kernel(detect_features(scene, camera), render_settings.max_depth);
+  if (render_settings.ambient_occlusion)
+    kernel = &trace_ambient_occlusion;
+  trace_first_hits(film, *scene.root, camera);
+  for (int h = 0; h < film.height; ++h)
+    publish_row(film, h);
 
-      const int AA_sample_count = 2000;
-      for (int AA_sample_iter = 0; AA_sample_iter < AA_sample_count; ++AA_sample_iter)
+  auto request_checkpoint = [&]()
+  {
+    checkpoint.scene_hash = scene.hash();
+    checkpoint.sampler_type = sampler.type();
+    checkpoint.sampler_seed = sampler.seed;
+    checkpoint.camera_orbit = orbit;
+    checkpoint.capture(film);
+    shared_thread_data.checkpoint_writer->request(checkpoint_path, checkpoint);
+  };
+  Time last_checkpoint_time = CurrentTime();
+
+  // after every camera move: a coarse preview of what reprojection left empty,
+  // then a 1 spp pass before passes of interactive_samples_per_pass
+  bool previewed = false;
+  int samples_per_pass = 1;
+
+  while (!shared_thread_data.terminate_requested)
+  {
+    if (shared_thread_data.camera_moved)
+    {
+      // orbit changes with the film, a checkpoint after an interrupted move keeps both as they were
+      CameraOrbit moved_orbit = TakeCameraOrbit();
+      Camera moved_camera = moved_orbit.make_camera(resolution_ratio);
+      Film moved_film(film.width, film.height);
+      if (!trace_first_hits(moved_film, *scene.root, moved_camera))
+        continue;
       {
-        float du = (w + uniform_rand()) / float(shared_frame.width);
-        float dv = (shared_frame.height - h + uniform_rand()) / float(shared_frame.height);
+        TraceScope trace("reproject", "render");
+        moved_film.reproject(film, camera, reprojection_max_history);
+      }
+
+      film = std::move(moved_film);
+      camera = moved_camera;
+      orbit = moved_orbit;
+      for (int h = 0; h < film.height; ++h)
+        publish_row(film, h);
 
-        pixel_color += compute_raycast(root, camera.get_ray(du, dv), 0);
+      previewed = false;
+      samples_per_pass = 1;
+    }
+
+    if (!previewed)
+    {
+      previewed = render_preview(film, *scene.root, camera, sampler, kernel);
+      continue;
+    }
+
+    bool converged = *std::min_element(film.sample_count.begin(), film.sample_count.end()) >= sample_count;
+    if (converged)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    else if (render_pass(film, *scene.root, camera, sampler, kernel, samples_per_pass, sample_count))
+    {
+      samples_per_pass = interactive_samples_per_pass;
+      // the pass is done, nothing records while the guide refines
+      if (scene.guide && scene.guide->training())
+      {
+        scene.guide->refine();
+        LogPathGuide(*scene.guide);
       }
-      pixel_color /= float(AA_sample_count);
-      pixel_color = Vec3(sqrtf(pixel_color.x), sqrtf(pixel_color.y), sqrtf(pixel_color.z));
+    }
 
-      shared_frame.pixel_buffer[h * shared_frame.width + w].r = int(255.99 * pixel_color.r);
-      shared_frame.pixel_buffer[h * shared_frame.width + w].g = int(255.99 * pixel_color.g);
-      shared_frame.pixel_buffer[h * shared_frame.width + w].b = int(255.99 * pixel_color.b);
+    if (!checkpoint_path.empty() && !converged && ElapsedTime(last_checkpoint_time, CurrentTime()) > checkpoint_interval)
+    {
+      request_checkpoint();
+      last_checkpoint_time = CurrentTime();
     }
   }
-  
-  for (auto iter = objects.begin(); iter != objects.end(); ++iter)
-    delete *iter;
+
+  // keep what was accumulated when the render is cancelled or restarted,
+  // the writer saves it while the next render starts
+  if (!checkpoint_path.empty())
+    request_checkpoint();
+}
+
+static void render_sequence(std::shared_ptr<Scene> scene, int sample_count)
+{
+  float resolution_ratio = shared_frame.height / float(shared_frame.width);
+  Camera camera = CurrentCamera(resolution_ratio);
+  ThreadPool pool;
+
+  RenderJobSettings settings;
+  settings.width = shared_frame.width;
+  settings.height = shared_frame.height;
+  settings.sample_count = sample_count;
+  settings.max_depth = render_settings.max_depth;
+  if (render_settings.ambient_occlusion)
+    settings.kernel = &trace_ambient_occlusion;
+  settings.on_tile = [](const RenderJob& job, const Tile& tile)
+  {
+    TraceScope trace("publish tile", "display", tile.x, tile.y);
+    for (int h = tile.y; h < tile.y + tile.height; ++h)
+      for (int w = tile.x; w < tile.x + tile.width; ++w)
+        shared_frame.pixel_buffer[h * job.width() + w] = job.image()[h * job.width() + w];
+  };
+
+  for (int frame = render_settings.frame_from; frame <= render_settings.frame_to; ++frame)
+  {
+    scene->set_frame(float(frame));
+
+    std::shared_ptr<RenderJob> job = start_render(pool, scene, camera, settings);
+    while (!job->wait_for(10))
+    {
+      if (shared_thread_data.terminate_requested)
+        job->cancel();
+    }
+    if (job->status() != RenderStatus::Finished)
+      break;
+
+    // later frames sample what this one learned
+    if (scene->guide && scene->guide->training())
+    {
+      scene->guide->refine();
+      LogPathGuide(*scene->guide);
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "frame_%04d.ppm", frame);
+    write_ppm(path, job->image().data(), job->width(), job->height());
+  }
+}
+
+static void render_turntable(std::shared_ptr<Scene> scene, int sample_count)
+{
+  float resolution_ratio = shared_frame.height / float(shared_frame.width);
+  scene->set_frame(0);
+
+  CameraOrbit orbit = TakeCameraOrbit();
+  std::vector<Camera> cameras;
+  for (int view = 0; view < render_settings.turntable_views; ++view)
+  {
+    CameraOrbit view_orbit = orbit;
+    view_orbit.theta += 2 * pi * view / render_settings.turntable_views;
+    cameras.push_back(view_orbit.make_camera(resolution_ratio));
+  }
+
+  RenderJobSettings settings;
+  settings.width = shared_frame.width;
+  settings.height = shared_frame.height;
+  settings.sample_count = sample_count;
+  settings.max_depth = render_settings.max_depth;
+  if (render_settings.ambient_occlusion)
+    settings.kernel = &trace_ambient_occlusion;
+
+  ThreadPool pool;
+  RenderBatch batch = start_render_views(pool, scene, cameras, settings);
+  while (batch.progress() < 1.0f)
+  {
+    if (shared_thread_data.terminate_requested)
+      batch.cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (batch.wait() != RenderStatus::Finished)
+    return;
+
+  for (size_t view = 0; view < batch.views.size(); ++view)
+  {
+    const RenderJob& job = *batch.views[view];
+    char path[64];
+    snprintf(path, sizeof(path), "view_%02d.ppm", int(view));
+    write_ppm(path, job.image().data(), job.width(), job.height());
+  }
+  std::copy(batch.views[0]->image().begin(), batch.views[0]->image().end(), shared_frame.pixel_buffer);
+}
+
+static void LogBatchStage(const char* name, const char* unit, const BatchStageStats& stage, double seconds)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "batch %s: %lld %s, %.2f s busy (%.0f%%), %.2f %s/s while busy\n", name, stage.item_count, unit,
+    stage.busy_seconds, seconds > 0 ? 100 * stage.busy_seconds / seconds : 0, stage.busy_seconds > 0 ? stage.item_count / stage.busy_seconds : 0, unit);
+  OutputDebugStringA(message);
+}
+
+static void LogBatch(const BatchStats& stats)
+{
+  char message[256];
+  snprintf(message, sizeof(message), "batch: %lld images in %.2f s, %d failed, %.2f Msamples/s traced, %.1f MB/s written\n",
+    stats.write.item_count, stats.seconds, stats.failed_count,
+    stats.trace.busy_seconds > 0 ? stats.sample_count / stats.trace.busy_seconds * 1e-6 : 0,
+    stats.write.busy_seconds > 0 ? stats.byte_count / stats.write.busy_seconds * 1e-6 : 0);
+  OutputDebugStringA(message);
+  LogBatchStage("load", "scenes", stats.load, stats.seconds);
+  LogBatchStage("trace", "jobs", stats.trace, stats.seconds);
+  LogBatchStage("write", "images", stats.write, stats.seconds);
+}
+
+// runs the job list once, a run cancelled by a resize starts over
+static void render_batch()
+{
+  std::vector<BatchJob> jobs;
+  std::vector<int> bad_lines;
+  if (!load_batch_jobs(render_settings.batch_path.c_str(), jobs, bad_lines))
+  {
+    OutputDebugStringA("batch: cannot read the job list\n");
+    render_settings.batch_path.clear();
+    return;
+  }
+  for (auto iter = bad_lines.begin(); iter != bad_lines.end(); ++iter)
+  {
+    char message[64];
+    snprintf(message, sizeof(message), "batch: skipped malformed line %d\n", *iter);
+    OutputDebugStringA(message);
+  }
+
+  if (render_settings.path_guiding)
+    OutputDebugStringA("batch: --guiding is ignored, job scenes render unguided\n");
+
+  BatchSettings settings;
+  settings.max_depth = render_settings.max_depth;
+  if (render_settings.ambient_occlusion)
+    settings.kernel = &trace_ambient_occlusion;
+
+  ThreadPool pool;
+  CancellationToken token;
+  BatchStats stats;
+  std::atomic<bool> done(false);
+  std::thread runner([&]()
+  {
+    stats = run_batch(pool, jobs, settings, token);
+    done = true;
+  });
+  while (!done)
+  {
+    if (shared_thread_data.terminate_requested)
+      token.cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  runner.join();
+
+  LogBatch(stats);
+  // only closing the window cancels a batch, a resize leaves it running
+  render_settings.batch_path.clear();
+}
+
+static void render_poster(Scene& scene, int sample_count)
+{
+  scene.set_frame(0);
+  Camera camera = CurrentCamera(render_settings.poster_height / float(render_settings.poster_width));
+
+  TiledRenderSettings settings;
+  settings.width = render_settings.poster_width;
+  settings.height = render_settings.poster_height;
+  settings.sample_count = sample_count;
+  settings.max_depth = render_settings.max_depth;
+  settings.features = detect_features(scene, camera);
+  if (render_settings.ambient_occlusion)
+    settings.kernel = &trace_ambient_occlusion;
+  render_tiled_to_file(*scene.root, camera, settings, render_settings.poster_path.c_str(), shared_thread_data.terminate_requested);
+}
+
+void thread_renderer()
+{
+  const int AA_sample_count = render_settings.sample_count;
+  Sampler* sampler = create_sampler(SamplerType::Sobol, AA_sample_count, 0);
+
+  shared_thread_data.data_security.lock();
+
+  // the scene outlives a single run, resizing only restarts tracing
+  if (!shared_thread_data.scene)
+  {
+    if (render_settings.texture_benchmark)
+      RunTextureBenchmark();
+    if (render_settings.bvh_benchmark)
+      RunBVHBenchmark();
+    {
+      TraceScope trace("scene load", "scene");
+      shared_thread_data.scene.reset(create_random_scene(render_settings.lazy_bvh));
+    }
+    LogBVHBuild(shared_thread_data.scene->bvh_stats);
+    if (render_settings.occlusion_benchmark)
+      RunOcclusionBenchmark(*shared_thread_data.scene);
+    // only the interactive and sequence loops refine between passes, elsewhere the guide would
+    // record into training forever and never be sampled
+    if (render_settings.path_guiding && (render_settings.poster || render_settings.turntable_views > 0))
+      OutputDebugStringA("path guide: --guiding is ignored by poster and turntable renders\n");
+    else if (render_settings.path_guiding)
+      shared_thread_data.scene->enable_path_guiding(guide_training_passes);
+  }
+
+  if (!render_settings.batch_path.empty())
+  {
+    render_batch();
+    shared_thread_data.batch_running = false;
+  }
+  else if (render_settings.poster)
+    render_poster(*shared_thread_data.scene, AA_sample_count);
+  else if (render_settings.turntable_views > 0)
+    render_turntable(shared_thread_data.scene, AA_sample_count);
+  else if (render_settings.sequence)
+    render_sequence(shared_thread_data.scene, AA_sample_count);
+  else
+    render_interactive(*shared_thread_data.scene, *sampler, AA_sample_count);
+
+  // holds every run so far, a restart rewrites it with the longer timeline
+  if (tracing_enabled())
+    write_chrome_trace(render_settings.trace_path.c_str());
+
+  delete sampler;
   shared_thread_data.data_security.unlock();
 }
\ No newline at end of file
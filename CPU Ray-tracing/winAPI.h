@@ -4,9 +4,16 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <string>
+#include <memory>
 
 #include "vector.h"
 #include "ray.h"
+#include "image.h"
+#include "camera.h"
+
+struct Scene;
+class CheckpointWriter;
 
 extern struct WinAPI
 {
@@ -26,20 +33,6 @@ extern struct WinAPI
   HGLRC hglrc;
 } winAPI;
 
-const float pi = 3.141592f;
-
-union Pixel
-{
-  unsigned char data[4];
-  struct
-  {
-    unsigned char b;
-    unsigned char g;
-    unsigned char r;
-    unsigned char a;
-  };
-};
-
 extern struct Frame
 {
   Pixel* pixel_buffer = nullptr;
@@ -56,24 +49,6 @@ extern struct Frame
 
 } shared_frame;
 
-class Camera
-{
-private:
-  Vec3 bottom_left, horizontal, vertical;
-  Vec3 up, right, look;
-  Vec3 random_in_unit_disk();
-  float focus_dist;
-  float time_from, time_to;
-
-public:
-  Vec3 position;
-  float lens_radius = 0;
-
-  Camera(const Vec3& position, float theta, float phi, float focus_dist, float time_from, float time_to);
-
-  Ray get_ray(float du, float dv);
-};
-
 extern struct ThreadData
 {
   // non-shared
@@ -83,14 +58,72 @@ extern struct ThreadData
   // shared
   std::atomic<bool> terminate_requested = false;
   std::mutex data_security;
+  std::shared_ptr<Scene> scene;
 
-  inline ~ThreadData()
-  {
-    terminate_requested = true;
+  // interactive camera, written by the UI thread
+  std::mutex camera_security;
+  CameraOrbit camera_orbit;
+  std::atomic<bool> camera_moved = false;
 
-    // if rendering, request termination
-    if (thread_renderer.joinable())
-      thread_renderer.join();
-  }
+  // the renderer works through a job list, resizing the window does not restart it
+  std::atomic<bool> batch_running = false;
+
+  // outlives render threads so a restart does not wait for the last checkpoint to be written,
+  // only used by the render thread
+  CheckpointWriter* checkpoint_writer = nullptr;
+
+  // joins the renderer and flushes the last checkpoint, WinMain calls it before returning
+  void stop();
+  ~ThreadData();
+
+} shared_thread_data;
+
+extern struct RenderSettings
+{
+  int sample_count = 2000;
+  int max_depth = 50;
+  // shades with ambient occlusion instead of path tracing
+  bool ambient_occlusion = false;
+
+  // renders frame_from..frame_to to files instead of a single still
+  bool sequence = false;
+  int frame_from = 0;
+  int frame_to = 0;
+
+  // renders poster_width x poster_height tile by tile straight into poster_path
+  bool poster = false;
+  int poster_width = 0;
+  int poster_height = 0;
+  std::string poster_path;
+
+  // renders turntable_views views around the camera orbit in one batch to view_##.ppm
+  int turntable_views = 0;
+
+  // periodically saves the interactive accumulation to checkpoint_path with the window size appended,
+  // resume continues from the one of the current size when scene and sampler match
+  std::string checkpoint_path;
+  bool resume = false;
+
+  // logs resident and streamed texture throughput under incoherent lookups once at startup
+  bool texture_benchmark = false;
+
+  // logs memory per primitive and coherent and incoherent ray throughput of every BVH layout once at startup
+  bool bvh_benchmark = false;
+
+  // logs any-hit against closest-hit throughput of ambient occlusion rays in the window's view once at startup
+  bool occlusion_benchmark = false;
+
+  // builds the BVH on demand while tracing instead of before it
+  bool lazy_bvh = false;
+
+  // learns where light comes from over the first passes and samples diffuse bounces towards it
+  // in interactive and sequence renders, which refine it between passes
+  bool path_guiding = false;
+
+  // job list rendered once in place of the window's scene, cleared when the run ends.
+  // resizing the window leaves it running, only closing the window cancels it
+  std::string batch_path;
 
-} shared_thread_data;
\ No newline at end of file
+  // Chrome trace JSON of scene, render, output and display events, empty when not tracing
+  std::string trace_path;
+} render_settings;
\ No newline at end of file